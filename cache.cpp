@@ -0,0 +1,203 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+using namespace std;
+
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "grid.h"
+#include "sha256.h"
+
+//
+// A stream buffer which writes to two others, as tee does. Only the first
+// decides whether a write succeeded; a failure writing the second is
+// remembered, so that what it holds can be thrown away afterward.
+//
+class TeeBuf : public streambuf {
+   public:
+      TeeBuf(streambuf *a, streambuf *b) : a(a), b(b), b_failed(false) {}
+
+      bool second_failed() const { return b_failed; }
+
+   protected:
+      int_type overflow(int_type c) {
+         if (c == traits_type::eof()) return traits_type::not_eof(c);
+         if (b->sputc(c) == traits_type::eof()) b_failed = true;
+         return a->sputc(c);
+      }
+
+      streamsize xsputn(const char *s, streamsize n) {
+         if (b->sputn(s, n) != n) b_failed = true;
+         return a->sputn(s, n);
+      }
+
+      int sync() {
+         if (b->pubsync() == -1) b_failed = true;
+         return a->pubsync();
+      }
+
+   private:
+      streambuf *a, *b;
+      bool b_failed;
+};
+
+// write a string so that no choice of its contents can be mistaken for
+// the fields which follow it
+static void field(ostream &k, const char *name, const string &s)
+{
+   k << name << ' ' << s.size() << ':' << s << '\n';
+}
+
+
+string Grid::digest() const
+{
+   //
+   // The key is made from the options as the constructor has settled
+   // them, after defaults are filled in and the dimensions solved, so
+   // specs which differ only in order or in spelling out what would have
+   // been worked out anyway draw the same grid and share a digest.
+   //
+   ostringstream k;
+   k << setprecision(17);
+
+   field(k, "mkhexgrid", VERSION);
+   k << "output " << output << '\n';
+
+   // these matter only for PNG; the others are antialiased regardless.
+   // Only a PNG deflated in parallel depends on the threads and strip,
+   // which set where its pieces fall.
+   if (output == PNG) {
+      k << "antialiased " << antialiased << '\n'
+        << "stamping " << stamping << '\n'
+        << "png " << png_level << ' ' << png_filter << ' ' << png_color
+        << ' ' << png_parallel << '\n';
+      if (png_parallel) {
+         k << "threads " << threads << '\n'
+           << "strip " << strip << '\n';
+      }
+   }
+   else {
+      k << "precision " << precision << '\n'
+        << "svg " << svg_pattern << ' ' << svg_label_runs << '\n'
+        << "gzip " << gzip << '\n'
+        << "ps " << ps_label_proc << '\n';
+   }
+
+   k << "grid " << grid_thickness << ' ' << grid_opacity << '\n';
+   field(k, "grid_color", grid_color);
+
+   k << "bg " << bg_opacity << ' ' << matte << '\n';
+   field(k, "bg_color", bg_color);
+
+   k << "grain " << grain << ' ' << lowfirstcol << '\n'
+     << "hex " << hw << ' ' << hh << ' ' << hs << '\n'
+     << "image " << iw << ' ' << ih << '\n'
+     << "margin " << mtop << ' ' << mright << ' ' << mbottom << ' '
+     << mleft << '\n'
+     << "size " << cols << ' ' << rows << '\n'
+     << "map " << map_cols << ' ' << map_rows << ' ' << view_col << ' '
+     << view_row << '\n';
+
+   k << "center " << center_style << ' ' << center_size << ' '
+     << center_opacity << '\n';
+   field(k, "center_color", center_color);
+
+   k << "coord " << coord_display << '\n';
+   if (coord_display) {
+      k << "coord_skip " << coord_cskip << ' ' << coord_rskip << '\n'
+        << "coord_start " << coord_cstart << ' ' << coord_rstart << '\n'
+        << "coord_origin " << coord_origin << '\n'
+        << "coord_style " << coord_order << ' '
+        << coord_first_style << ' ' << coord_first_width << ' '
+        << coord_first_fill << ' '
+        << coord_second_style << ' ' << coord_second_width << ' '
+        << coord_second_fill << '\n'
+        << "coord_text " << coord_size << ' ' << coord_bearing << ' '
+        << coord_dist << ' ' << coord_tilt << ' ' << coord_opacity << '\n';
+      field(k, "coord_fmt_pre", coord_fmt_pre);
+      field(k, "coord_fmt_inter", coord_fmt_inter);
+      field(k, "coord_fmt_post", coord_fmt_post);
+      field(k, "coord_font", coord_font);
+      field(k, "coord_color", coord_color);
+   }
+
+   return sha256(k.str());
+}
+
+
+void Grid::draw_cached(ostream &os)
+{
+   static const char *ext[] = { ".png", ".ps", ".svg" };
+   const string path = cache_dir + '/' + digest() + ext[output] +
+                       (gzip ? ".gz" : "");
+
+   // a grid drawn before is copied out as it was kept
+   {
+      ifstream hit(path.c_str(), ios::in | ios::binary);
+      if (hit && hit.peek() != ifstream::traits_type::eof()) {
+         os << hit.rdbuf();
+         return;
+      }
+   }
+
+   //
+   // Otherwise the grid is drawn both to the stream and to a file which
+   // is renamed into the cache only once it is whole, so that no other
+   // process drawing the same grid can see it half written.
+   //
+   static atomic<unsigned int> serial(0);
+   ostringstream tmp;
+   tmp << path << ".tmp" << getpid() << '-' << serial++;
+
+   filebuf file;
+   if (!file.open(tmp.str().c_str(), ios::out | ios::binary))
+      throw runtime_error("cannot write to cache directory " + cache_dir);
+
+   TeeBuf tee(os.rdbuf(), &file);
+   ostream out(&tee);
+
+   try {
+      render(out);
+   }
+   catch (...) {
+      file.close();
+      remove(tmp.str().c_str());
+      throw;
+   }
+
+   if (!file.close() || tee.second_failed() ||
+       rename(tmp.str().c_str(), path.c_str()))
+      remove(tmp.str().c_str());
+
+   if (!out) os.setstate(ios::badbit);
+}
@@ -0,0 +1,276 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#ifndef WIN32
+#include <fontconfig/fontconfig.h>
+#endif
+
+#include "font.h"
+
+// text is set at 96dpi, as GD does
+static const int resolution = 96;
+
+static FT_Library library;
+static mutex library_lock;
+
+// fonts kept, with when each was last asked for
+typedef map<pair<pair<string, double>, pair<double, bool> >,
+            pair<shared_ptr<Font>, unsigned long> > FontMap;
+static FontMap fonts;
+static unsigned long font_uses;
+
+// fonts kept for use again, at most
+static const size_t max_fonts = 16;
+
+
+shared_ptr<Font> Font::get(const string &name, double size, double tilt,
+                           bool antialiased)
+{
+   // a font dropped from the cache is freed once the lock is released,
+   // unless an image being drawn still holds it
+   shared_ptr<Font> dropped;
+   lock_guard<mutex> guard(library_lock);
+
+   if (!library && FT_Init_FreeType(&library))
+      throw runtime_error("cannot initialize FreeType");
+
+   const FontMap::key_type key(make_pair(name, size),
+                               make_pair(tilt, antialiased));
+   FontMap::iterator i = fonts.find(key);
+   if (i == fonts.end()) {
+      if (fonts.size() >= max_fonts) {
+         // drop the font used longest ago
+         FontMap::iterator old = fonts.begin();
+         for (FontMap::iterator j = fonts.begin(); j != fonts.end(); ++j)
+            if (j->second.second < old->second.second) old = j;
+         dropped = old->second.first;
+         fonts.erase(old);
+      }
+
+      shared_ptr<Font> f(new Font(name, size, tilt, antialiased),
+                         &Font::destroy);
+      i = fonts.insert(make_pair(key, make_pair(f, 0UL))).first;
+   }
+
+   i->second.second = ++font_uses;
+   return i->second.first;
+}
+
+
+void Font::destroy(Font *f)
+{
+   // faces are made and done with one at a time
+   lock_guard<mutex> guard(library_lock);
+   delete f;
+}
+
+
+Font::Font(const string &name, double size, double tilt, bool antialiased)
+ : face(0), tsin(sin(tilt)), tcos(cos(tilt)), antialiased(antialiased),
+   kern(false)
+{
+   // find the font file
+   string file;
+   int index = 0;
+
+#ifdef WIN32
+   // fonts given by name are looked for where Windows keeps them
+   if (name.find_first_of("/\\.") != string::npos) file = name;
+   else {
+      const char *windir = getenv("WINDIR");
+      file = string(windir ? windir : "C:\\Windows") +
+             "\\Fonts\\" + name + ".ttf";
+   }
+#else
+   FcPattern *pat = FcNameParse((const FcChar8 *) name.c_str());
+   if (!pat) throw runtime_error("cannot parse font name `" + name + "'");
+
+   FcConfigSubstitute(NULL, pat, FcMatchPattern);
+   FcDefaultSubstitute(pat);
+
+   FcResult res;
+   FcPattern *match = FcFontMatch(NULL, pat, &res);
+   FcPatternDestroy(pat);
+
+   FcChar8 *f;
+   if (!match || FcPatternGetString(match, FC_FILE, 0, &f) != FcResultMatch) {
+      if (match) FcPatternDestroy(match);
+      throw runtime_error("cannot find font `" + name + "'");
+   }
+
+   file = (const char *) f;
+   FcPatternGetInteger(match, FC_INDEX, 0, &index);
+   FcPatternDestroy(match);
+#endif
+
+   FT_Face ft;
+   if (FT_New_Face(library, file.c_str(), index, &ft))
+      throw runtime_error("cannot open font `" + file + "'");
+
+   if (FT_Set_Char_Size(ft, 0, FT_F26Dot6(size*64),
+                        resolution, resolution)) {
+      FT_Done_Face(ft);
+      throw runtime_error("cannot set font size for `" + file + "'");
+   }
+
+   FT_Matrix m;
+   m.xx = FT_Fixed( tcos*0x10000);
+   m.xy = FT_Fixed(-tsin*0x10000);
+   m.yx = FT_Fixed( tsin*0x10000);
+   m.yy = FT_Fixed( tcos*0x10000);
+   FT_Set_Transform(ft, &m, NULL);
+
+   face = ft;
+   kern = FT_HAS_KERNING(ft);
+}
+
+
+Font::~Font()
+{
+   FT_Done_Face((FT_Face) face);
+}
+
+
+const Glyph &Font::glyph(unsigned long ch)
+{
+   lock_guard<mutex> guard(lock);
+
+   // glyphs once cached stay where they are, so they may be read
+   // without the lock
+   map<unsigned long, Glyph>::iterator i = glyphs.find(ch);
+   if (i != glyphs.end()) return i->second;
+
+   // not seen before, so rasterize it
+   FT_Face ft = (FT_Face) face;
+   FT_Int32 flags = FT_LOAD_RENDER;
+   if (!antialiased) flags |= FT_LOAD_TARGET_MONO | FT_LOAD_MONOCHROME;
+
+   if (FT_Load_Char(ft, ch, flags))
+      throw runtime_error("cannot render glyph");
+
+   const FT_GlyphSlot slot = ft->glyph;
+   const FT_Bitmap &bm = slot->bitmap;
+
+   Glyph g;
+   g.x = slot->bitmap_left;
+   g.y = -slot->bitmap_top;
+   g.width = bm.width;
+   g.height = bm.rows;
+   g.advance = slot->metrics.horiAdvance;
+   g.index = FT_Get_Char_Index(ft, ch);
+   g.l = g.t = INT_MAX;
+   g.r = g.b = INT_MIN;
+   g.mask.resize(size_t(g.width)*g.height);
+
+   for (int y = 0; y < g.height; ++y) {
+      const unsigned char *p = bm.buffer + y*bm.pitch;
+      unsigned char *q = g.width ? &g.mask[size_t(y)*g.width] : 0;
+      for (int x = 0; x < g.width; ++x) {
+         if (bm.pixel_mode == FT_PIXEL_MODE_MONO)
+            q[x] = (p[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+         else q[x] = p[x];
+
+         if (q[x]) {
+            g.l = min(g.l, x);
+            g.r = max(g.r, x);
+            g.t = min(g.t, y);
+            g.b = max(g.b, y);
+         }
+      }
+   }
+
+   return glyphs.insert(make_pair(ch, g)).first->second;
+}
+
+
+long Font::kerning(unsigned int a, unsigned int b)
+{
+   lock_guard<mutex> guard(lock);
+
+   const pair<unsigned int, unsigned int> key(a, b);
+   map<pair<unsigned int, unsigned int>, long>::const_iterator i =
+      kerns.find(key);
+   if (i != kerns.end()) return i->second;
+
+   FT_Vector k;
+   if (FT_Get_Kerning((FT_Face) face, a, b, FT_KERNING_DEFAULT, &k))
+      k.x = 0;
+   return kerns[key] = k.x;
+}
+
+
+void Font::layout(const string &str, Text &text)
+{
+   text.pieces.clear();
+   text.l = text.t = INT_MAX;
+   text.r = text.b = INT_MIN;
+
+   // the pen advances along the unrotated baseline, in 1/64 pixels
+   long pen = 0;
+   unsigned int prev = 0;
+
+   for (string::size_type i = 0; i < str.length(); ) {
+      // decode UTF-8
+      unsigned long ch = (unsigned char) str[i++];
+      int more = 0;
+      if      (ch >= 0xf0) { ch &= 0x07; more = 3; }
+      else if (ch >= 0xe0) { ch &= 0x0f; more = 2; }
+      else if (ch >= 0xc0) { ch &= 0x1f; more = 1; }
+      for ( ; more && i < str.length(); --more)
+         ch = (ch << 6) | (str[i++] & 0x3f);
+
+      const Glyph &g = glyph(ch);
+
+      if (kern && prev && g.index) pen += kerning(prev, g.index);
+      prev = g.index;
+
+      Text::Piece p;
+      p.glyph = &g;
+      p.x = int(floor(pen*tcos/64 + 0.5));
+      p.y = int(floor(-pen*tsin/64 + 0.5));
+      text.pieces.push_back(p);
+
+      if (g.l <= g.r) {
+         text.l = min(text.l, p.x + g.x + g.l);
+         text.r = max(text.r, p.x + g.x + g.r);
+         text.t = min(text.t, p.y + g.y + g.t);
+         text.b = max(text.b, p.y + g.y + g.b);
+      }
+
+      pen += g.advance;
+   }
+
+   // nothing inked
+   if (text.l > text.r) text.l = text.t = text.r = text.b = 0;
+}
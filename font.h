@@ -0,0 +1,95 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __FONT_H_
+#define __FONT_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+//
+// A rasterized glyph: an 8-bit coverage mask (255 is fully covered) and
+// its offset from the pen position, with y increasing downwards.
+//
+struct Glyph {
+   int x, y;
+   int width, height;
+   int l, t, r, b;               // inked part of the mask, none if l > r
+   long advance;                 // unrotated advance in 1/64 pixels
+   unsigned int index;           // glyph index in the face, for kerning
+   vector<unsigned char> mask;
+};
+
+//
+// A string laid out with cached glyphs, relative to its pen origin.
+//
+struct Text {
+   struct Piece {
+      const Glyph *glyph;
+      int x, y;                  // pen position of the glyph
+   };
+
+   vector<Piece> pieces;
+   int l, t, r, b;               // bounds of the inked pixels
+};
+
+//
+// A font face at one size and tilt. Each glyph is rasterized by FreeType
+// the first time it is needed, and its mask reused after that. Fonts are
+// shared, and safe to use from several threads; only looking glyphs and
+// kerning up is done one thread at a time, not whole layouts.
+//
+// Only the fonts used last are kept once no image is drawn with them, so
+// that a process drawing grids in many fonts and sizes does not keep a
+// face open for each.
+//
+class Font {
+   public:
+      static shared_ptr<Font> get(const string &name, double size,
+                                  double tilt, bool antialiased);
+
+      void layout(const string &str, Text &text);
+
+   private:
+      Font(const string &name, double size, double tilt, bool antialiased);
+      ~Font();
+
+      Font(const Font &);
+      Font &operator=(const Font &);
+
+      static void destroy(Font *f);
+
+      // glyphs and kerning, found in or added to the caches under the lock
+      const Glyph &glyph(unsigned long ch);
+      long kerning(unsigned int a, unsigned int b);
+
+      void *face;                // FT_Face, kept out of this header
+      double tsin, tcos;
+      bool antialiased;
+      bool kern;                 // whether the face has kerning
+      map<unsigned long, Glyph> glyphs;
+      map<pair<unsigned int, unsigned int>, long> kerns;
+      mutex lock;                // guards the face and the caches
+};
+
+#endif /* __FONT_H_ */
@@ -18,6 +18,7 @@
  */
 
 #include <cmath>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <map>
@@ -30,9 +31,17 @@ using namespace std;
 using namespace boost;
 
 #include "grid.h"
+#include "gzipbuf.h"
+#include "libmkhexgrid.h"
 
 const double Grid::rad = M_PI/180.0;
 
+static bool ends_with(const string &s, const string &end)
+{
+   return s.size() >= end.size() &&
+          s.compare(s.size() - end.size(), end.size(), end) == 0;
+}
+
 Grid::Grid(const map<string, string> &opt)
 {
    map<string, string>::const_iterator i;
@@ -40,30 +49,142 @@ Grid::Grid(const map<string, string> &opt)
    // 
    // Output Parameters
    //
+   tiled = false;
+
    i = opt.find("output");
    if (i == opt.end())          output = PNG;
    else if (i->second == "png") output = PNG;
    else if (i->second == "ps")  output = PS;
    else if (i->second == "svg") output = SVG;
+   else if (i->second == "tiles") {
+      output = PNG;
+      tiled = true;
+   }
    else throw runtime_error("unrecognized output type `" + i->second + "'");
 
    i = opt.find("outfile");
    if (i != opt.end()) outfile = i->second;
 
+   gzip = (opt.find("gzip") != opt.end());
+
+   i = opt.find("cache");
+   if (i != opt.end()) {
+      if (i->second.empty())
+         throw runtime_error("cache directory is empty");
+      cache_dir = i->second;
+   }
+
    antialiased = (opt.find("antialias") != opt.end());
-   if (antialiased && output != PNG)
-      cerr << "PostScript and SVG output is always antialiased" << endl;
 
-   // NB: this works because 0 is opaque in PNG, 1 is opaque in SVG, and
-   // opacity is ignored in PostScript.
-   bg_opacity = grid_opacity =
-      coord_opacity = center_opacity = (output == SVG);
+   threads = 1;
 
-   if (output == PS) 
-        grid_color = coord_color = center_color = "0.5 0.5 0.5";
-   else grid_color = coord_color = center_color = "808080";
+   i = opt.find("threads");
+   if (i != opt.end()) {
+      try {
+         threads = lexical_cast<unsigned int>(i->second);
+      }
+      catch (bad_lexical_cast &) {
+         throw runtime_error("number of threads is not an integer");
+      }
+   }
+
+   svg_pattern = false;
+
+   i = opt.find("svg-grid");
+   if (i != opt.end()) {
+      if (i->second == "pattern")   svg_pattern = true;
+      else if (i->second != "rows") throw runtime_error(
+         "unrecognized SVG grid type `" + i->second + "'");
+   }
+
+   svg_label_runs = false;
+
+   i = opt.find("svg-labels");
+   if (i != opt.end()) {
+      if (i->second == "runs")       svg_label_runs = true;
+      else if (i->second != "hexes") throw runtime_error(
+         "unrecognized SVG label type `" + i->second + "'");
+   }
+
+   ps_label_proc = false;
+
+   i = opt.find("ps-labels");
+   if (i != opt.end()) {
+      if (i->second == "procedure")  ps_label_proc = true;
+      else if (i->second != "array") throw runtime_error(
+         "unrecognized PostScript label type `" + i->second + "'");
+   }
 
-   if (output == PNG) bg_color = "ffffff";
+   precision = -1;
+
+   i = opt.find("precision");
+   if (i != opt.end()) {
+      try {
+         precision = lexical_cast<int>(i->second);
+      }
+      catch (bad_lexical_cast &) {
+         throw runtime_error("precision is not an integer");
+      }
+
+      if (precision < 0)
+         throw range_error("precision is not between 0 and 15");
+   }
+
+   strip = 2048;
+
+   i = opt.find("strip-height");
+   if (i != opt.end()) {
+      try {
+         strip = lexical_cast<unsigned int>(i->second);
+      }
+      catch (bad_lexical_cast &) {
+         throw runtime_error("strip height is not an integer");
+      }
+   }
+
+   stamping = (opt.find("stamp") != opt.end());
+
+   png_level = 9;
+
+   i = opt.find("png-compression");
+   if (i != opt.end()) {
+      try {
+         png_level = lexical_cast<int>(i->second);
+      }
+      catch (bad_lexical_cast &) {
+         throw runtime_error("compression level is not an integer");
+      }
+   }
+
+   i = opt.find("png-filter");
+   if (i == opt.end())               png_filter = 5;
+   else if (i->second == "none")     png_filter = 0;
+   else if (i->second == "sub")      png_filter = 1;
+   else if (i->second == "up")       png_filter = 2;
+   else if (i->second == "average")  png_filter = 3;
+   else if (i->second == "paeth")    png_filter = 4;
+   else if (i->second == "adaptive") png_filter = 5;
+   else throw runtime_error("unrecognized PNG filter `" + i->second + "'");
+
+   png_parallel = false;
+
+   i = opt.find("png-deflate");
+   if (i != opt.end()) {
+      if (i->second == "parallel")    png_parallel = true;
+      else if (i->second != "serial") throw runtime_error(
+         "unrecognized PNG deflate type `" + i->second + "'");
+   }
+
+   i = opt.find("png-color");
+   if (i == opt.end())                png_color = 0;
+   else if (i->second == "truecolor") png_color = 0;
+   else if (i->second == "gray")      png_color = 2;
+   else if (i->second == "palette")   png_color = 3;
+   else if (i->second == "bilevel")   png_color = 4;
+   else throw runtime_error("unrecognized PNG color type `" + i->second + "'");
+
+   // colors and opacities left unset take the output type's defaults
+   bg_opacity = grid_opacity = coord_opacity = center_opacity = -1;
  
    //
    // Grid Parameters
@@ -84,13 +205,9 @@ Grid::Grid(const map<string, string> &opt)
    i = opt.find("grid-thickness");
    if (i == opt.end()) grid_thickness = 1;
    else parse_length("grid thickness", i->second, grid_thickness);
-   if (grid_thickness < 0)
-      throw range_error("grid thickness is negative");
-   if (output == PNG && grid_thickness != floor(grid_thickness))
-      throw runtime_error("grid thickness is not an integer");
 
    i = opt.find("grid-color");
-   if (i != opt.end()) parse_color("grid color", i->second, grid_color);
+   if (i != opt.end()) grid_color = i->second;
 
    i = opt.find("grid-opacity");
    if (i != opt.end()) parse_opacity("grid opactiy", i->second, grid_opacity);
@@ -98,11 +215,6 @@ Grid::Grid(const map<string, string> &opt)
    //
    // Coordinate Parameters
    //
-#ifdef WIN32
-   coord_font = "Arial";
-#else
-   coord_font = "sans";
-#endif
    coord_bearing = 90;
    coord_tilt = coord_dist = 0;
    coord_size = 8; 
@@ -137,7 +249,6 @@ Grid::Grid(const map<string, string> &opt)
    i = opt.find("coord-size");
    if (i != opt.end())
       parse_length("coordinate size", i->second, coord_size);
-   if (coord_size <= 0) throw range_error("coordinate size is not positive");
       
    i = opt.find("coord-origin");
    if (i == opt.end())         coord_origin = UpperLeft;
@@ -158,9 +269,6 @@ Grid::Grid(const map<string, string> &opt)
       catch (bad_lexical_cast &) {
          throw runtime_error("coord-column-skip is not an integer");
       }
-      
-      if (coord_cskip == 0)
-         throw range_error("coord-column-skip is not positive");
    }
 
    i = opt.find("coord-row-skip");
@@ -171,9 +279,6 @@ Grid::Grid(const map<string, string> &opt)
       catch (bad_lexical_cast &) {
          throw runtime_error("coord-row-skip is not an integer");
       }
-
-      if (coord_rskip == 0)
-         throw range_error("coord-row-skip is not positive");
    }
 
    i = opt.find("coord-column-start");
@@ -213,27 +318,11 @@ Grid::Grid(const map<string, string> &opt)
    }
 
    i = opt.find("coord-color");
-   if (i != opt.end()) parse_color("coordinate color", i->second, coord_color);
+   if (i != opt.end()) coord_color = i->second;
 
    i = opt.find("coord-opacity");
    if (i != opt.end())
       parse_opacity("coordinate opacity", i->second, coord_opacity);
-  
-   switch (output) {
-   case PNG:
-      // 90 degrees is down in GD, except for text
-      // for which 90 degrees is up!
-      coord_bearing = -coord_bearing;
-      break;
-   case PS:
-      coord_bearing -= 90;
-      break;
-   case SVG:
-      // 90 degrees is down in SVG
-      coord_bearing = -coord_bearing;
-      coord_tilt = -coord_tilt;
-      break;
-   }
 
    //
    // Center Parameters
@@ -250,13 +339,9 @@ Grid::Grid(const map<string, string> &opt)
    i = opt.find("center-size");
    if (i != opt.end())
       parse_length("center size", i->second, center_size);
-   if (center_size < 0)
-      throw range_error("center size is negative");
-   if (output == PNG && center_size != floor(center_size))
-      throw runtime_error("center size is not an integer");
 
    i = opt.find("center-color");
-   if (i != opt.end()) parse_color("center color", i->second, center_color);
+   if (i != opt.end()) center_color = i->second;
 
    i = opt.find("center-opacity");
    if (i != opt.end())
@@ -266,15 +351,13 @@ Grid::Grid(const map<string, string> &opt)
    // Background Parameters
    // 
    i = opt.find("bg-color");
-   if (i != opt.end()) parse_color("background color", i->second, bg_color);
+   if (i != opt.end()) bg_color = i->second;
 
    i = opt.find("bg-opacity");
    if (i != opt.end())
       parse_opacity("background opacity", i->second, bg_opacity);
 
    matte = (opt.find("matte") != opt.end());
-   if (matte && bg_color.empty())
-      cerr << "matte is useless without background color" << endl;
 
    //
    // Size Parameters
@@ -340,15 +423,305 @@ Grid::Grid(const map<string, string> &opt)
       if (rows == 0) throw range_error("number of rows is not positive");
    }
 
+   // read wide and signed, so that no value can wrap around on its way to
+   // the range checks
+   long long v[4];
+
+   i = opt.find("viewport");
+   if (i != opt.end()) {
+      string str;
+      istringstream s(i->second);
+
+      for (int k = 0; k < 4; ++k) {
+         getline(s, str, k < 3 ? ',' : '\n');
+         try {
+            v[k] = lexical_cast<long long>(str);
+         }
+         catch (bad_lexical_cast &) {
+            throw runtime_error(
+               "viewport must be given as four integers (c,r,w,h)");
+         }
+      }
+
+      if (s.fail() || !s.eof()) throw runtime_error(
+         "viewport must be given as four integers (c,r,w,h)");
+   }
+
    i = opt.find("image-width");
    if (i != opt.end()) parse_length("image width", i->second, iw);
 
    i = opt.find("image-height");
    if (i != opt.end()) parse_length("image height", i->second, ih);
 
+   settle(opt.find("centered") != opt.end(),
+          opt.find("viewport") != opt.end() ? v : 0);
+}
+
+
+Grid::Grid(const GridOptions &opt)
+{
+   static const OutputType outputs[] = { PNG, PS, SVG };
+   static const CoordOrigin origins[] = {
+      UpperLeft, UpperRight, LowerLeft, LowerRight
+   };
+   static const CenterStyle centers[] = { Centerless, Dot, Cross };
+   static const int colors[] = { 0, 3, 2, 4 };
+
+   // output parameters
+   output = outputs[opt.output];
+   tiled = false;
+   cache_dir = opt.cache_dir;
+   gzip = opt.gzip;
+   antialiased = opt.antialiased;
+   threads = opt.threads;
+   svg_pattern = opt.svg_pattern;
+   svg_label_runs = opt.svg_label_runs;
+   ps_label_proc = opt.ps_label_proc;
+   precision = opt.precision < 0 ? -1 : opt.precision;
+   strip = opt.strip_height;
+   stamping = opt.stamp;
+   png_level = opt.png_compression;
+   png_filter = opt.png_filter;
+   png_parallel = opt.png_parallel;
+   png_color = colors[opt.png_color];
+
+   // grid parameters
+   grain = opt.horizontal ? Horizontal : Vertical;
+   lowfirstcol = opt.first_in;
+   grid_thickness = opt.grid_thickness;
+   grid_color = opt.grid_color;
+   grid_opacity = opt.grid_opacity;
+
+   // coordinate parameters
+   coord_font = opt.coord_font;
+   coord_bearing = opt.coord_bearing;
+   coord_tilt = opt.coord_tilt;
+   coord_dist = opt.coord_distance;
+   coord_size = opt.coord_size;
+   coord_origin = origins[opt.coord_origin];
+   coord_cskip = opt.coord_column_skip;
+   coord_rskip = opt.coord_row_skip;
+   coord_cstart = opt.coord_column_start;
+   coord_rstart = opt.coord_row_start;
+
+   coord_order = ColumnsFirst;
+   coord_display = !opt.coord_format.empty();
+   if (coord_display) parse_format(opt.coord_format);
+
+   coord_color = opt.coord_color;
+   coord_opacity = opt.coord_opacity;
+
+   // center parameters
+   center_style = centers[opt.center_style];
+   center_size = opt.center_size;
+   center_color = opt.center_color;
+   center_opacity = opt.center_opacity;
+
+   // background parameters
+   bg_color = opt.bg_color;
+   bg_opacity = opt.bg_opacity;
+   matte = opt.matte;
+
+   // size parameters
+   mtop = opt.margin_top;
+   mright = opt.margin_right;
+   mbottom = opt.margin_bottom;
+   mleft = opt.margin_left;
+
+   hw = opt.hex_width;
+   hh = opt.hex_height;
+   hs = opt.hex_side;
+   iw = opt.image_width;
+   ih = opt.image_height;
+   cols = opt.columns;
+   rows = opt.rows;
+
+   const long long v[] = {
+      opt.view_column, opt.view_row, opt.view_columns, opt.view_rows
+   };
+
+   settle(opt.centered, opt.view_columns > 0 ? v : 0);
+}
+
+
+void Grid::settle(bool centered, const long long *view)
+{
+   //
+   // Output Parameters
+   //
+
+   // SVG and PostScript are gzipped as they are written when asked to be,
+   // or when the output file is named as a gzipped one
+   if (output == PNG) {
+      if (gzip) cerr << "gzip is used only for PostScript and SVG output"
+                     << endl;
+      gzip = false;
+   }
+   else if (ends_with(outfile, ".gz") ||
+            (output == SVG && ends_with(outfile, ".svgz"))) gzip = true;
+
+   if (tiled && !cache_dir.empty()) {
+      cerr << "tile output is not cached" << endl;
+      cache_dir.clear();
+   }
+
+   if (antialiased && output != PNG)
+      cerr << "PostScript and SVG output is always antialiased" << endl;
+
+   if (threads == 0) throw range_error("number of threads is not positive");
+   if (threads != 1 && output != PNG)
+      cerr << "threads are used only for PNG output" << endl;
+
+   if (svg_pattern && output != SVG)
+      cerr << "svg-grid is used only for SVG output" << endl;
+   if (svg_label_runs && output != SVG)
+      cerr << "svg-labels is used only for SVG output" << endl;
+   if (ps_label_proc && output != PS)
+      cerr << "ps-labels is used only for PostScript output" << endl;
+
+   if (precision > 15)
+      throw range_error("precision is not between 0 and 15");
+   if (precision >= 0 && output == PNG)
+      cerr << "precision is used only for PostScript and SVG output" << endl;
+
+   if (strip == 0) throw range_error("strip height is not positive");
+   if (strip != 2048 && (output != PNG || tiled))
+      cerr << "strip height is used only for PNG output" << endl;
+
+   if (stamping && (output != PNG || tiled))
+      cerr << "stamping is used only for PNG output" << endl;
+
+   if (png_level < 0 || png_level > 9)
+      throw range_error("compression level is not between 0 and 9");
+   if (png_level != 9 && output != PNG)
+      cerr << "compression level is used only for PNG output" << endl;
+
+   if (png_filter != 5 && output != PNG)
+      cerr << "PNG filter is used only for PNG output" << endl;
+
+   if (png_parallel && (output != PNG || tiled))
+      cerr << "PNG deflate type is used only for PNG output" << endl;
+
+   if (png_color != 0 && (output != PNG || tiled))
+      cerr << "PNG color type is used only for PNG output" << endl;
+
+   const char *gray = output == PS ? "0.5 0.5 0.5" : "808080";
+
+   //
+   // Grid Parameters
+   //
+   if (grid_thickness < 0)
+      throw range_error("grid thickness is negative");
+   if (output == PNG && !antialiased &&
+       grid_thickness != floor(grid_thickness))
+      throw runtime_error("grid thickness is not an integer");
+
+   if (grid_color.empty()) grid_color = gray;
+   else parse_color("grid color", grid_color, grid_color);
+
+   check_opacity("grid opactiy", grid_opacity);
+
+   //
+   // Coordinate Parameters
+   //
+   if (coord_font.empty()) {
+#ifdef WIN32
+      coord_font = "Arial";
+#else
+      coord_font = "sans";
+#endif
+   }
+
+   if (coord_size <= 0) throw range_error("coordinate size is not positive");
+
+   if (coord_cskip == 0)
+      throw range_error("coord-column-skip is not positive");
+   if (coord_rskip == 0)
+      throw range_error("coord-row-skip is not positive");
+
+   if (coord_color.empty()) coord_color = gray;
+   else parse_color("coordinate color", coord_color, coord_color);
+
+   check_opacity("coordinate opacity", coord_opacity);
+  
+   switch (output) {
+   case PNG:
+      // 90 degrees is down in GD, except for text
+      // for which 90 degrees is up!
+      coord_bearing = -coord_bearing;
+      break;
+   case PS:
+      coord_bearing -= 90;
+      break;
+   case SVG:
+      // 90 degrees is down in SVG
+      coord_bearing = -coord_bearing;
+      coord_tilt = -coord_tilt;
+      break;
+   }
+
+   //
+   // Center Parameters
+   //
+   if (center_size < 0)
+      throw range_error("center size is negative");
+   if (output == PNG && center_size != floor(center_size))
+      throw runtime_error("center size is not an integer");
+
+   if (center_color.empty()) center_color = gray;
+   else parse_color("center color", center_color, center_color);
+
+   check_opacity("center opacity", center_opacity);
+
+   //
+   // Background Parameters
+   // 
+   if (!bg_color.empty())
+      parse_color("background color", bg_color, bg_color);
+   else if (output == PNG) bg_color = "ffffff";
+
+   check_opacity("background opacity", bg_opacity);
+
+   if (matte && bg_color.empty())
+      cerr << "matte is useless without background color" << endl;
+
+   //
+   // Size Parameters
+   //
+   if (cols < 0) throw range_error("number of columns is not positive");
+   if (rows < 0) throw range_error("number of rows is not positive");
+
+   // a window onto a larger map, numbered as the whole map would be
+   map_cols = cols;
+   map_rows = rows;
+   view_col = view_row = 0;
+
+   if (view) {
+      if (!cols || !rows) throw runtime_error(
+         "viewport needs the number of columns and rows of the map");
+
+      if (view[0] < 0 || view[1] < 0 || view[2] < 0 || view[3] < 0)
+         throw range_error("viewport must not be negative");
+      if (view[2] == 0 || view[3] == 0)
+         throw range_error("viewport is empty");
+      if (view[0] + view[2] > cols || view[1] + view[3] > rows)
+         throw range_error("viewport lies outside the map");
+
+      view_col = view[0];
+      view_row = view[1];
+      cols = view[2];
+      rows = view[3];
+   }
+
    if (grain == Horizontal) {
       swap(hw, hh);
       swap(cols, rows);
+      swap(map_cols, map_rows);
+
+      // columns are drawn down the image, and rows from right to left
+      const int c = view_col;
+      view_col = view_row;
+      view_row = map_rows - c - rows;
 
       // rotate margins
       double tmp = mright;
@@ -408,18 +781,19 @@ Grid::Grid(const map<string, string> &opt)
       }
    
       if (hh && rows && cols && !ih) {         // calculate ih
-         if (cols > 1) ih = mtop + (0.5+rows)*hh+grid_thickness + mbottom;
+         if (map_cols > 1)
+            ih = mtop + (0.5+rows)*hh+grid_thickness + mbottom;
          else ih = mtop + rows*hh + grid_thickness + mbottom;
          more = true; 
       }
       else if (hh && !rows && cols && ih) {    // calculate rows
-         if (cols > 1)
+         if (map_cols > 1)
             rows = (int)floor((ih-mtop-grid_thickness-mbottom)/hh - 0.5);
          else rows = (int)floor((ih-mtop-grid_thickness-mbottom)/hh);
          more = true; 
       }
       else if (!hh && rows && cols && ih) {    // calculate hh
-         if (cols > 1) hh = (ih-mtop-grid_thickness-mbottom)/(0.5+rows);
+         if (map_cols > 1) hh = (ih-mtop-grid_thickness-mbottom)/(0.5+rows);
          else hh = (ih-mtop-grid_thickness-mbottom)/rows;
          more = true; 
       }
@@ -443,7 +817,7 @@ Grid::Grid(const map<string, string> &opt)
       throw runtime_error("unable to determine columns from given values");
 
    // adjust for centering
-   if (opt.find("centered") != opt.end()) {
+   if (centered) {
       // calculate actual grid width, height
       double aw = (0.25+0.75*cols)*hw+grid_thickness,
              ah = (0.5+rows)*hh+grid_thickness;
@@ -475,7 +849,6 @@ Grid::Grid(const map<string, string> &opt)
          break;
       case PNG:
          coord_bearing -= 90;
-         coord_tilt += 90;
          break;
       case SVG:
          coord_bearing -= 90;
@@ -490,7 +863,7 @@ Grid::Grid(const map<string, string> &opt)
          break;
       case LowerLeft:
          coord_origin = LowerRight;
-         if (cols%2) lowfirstcol = !lowfirstcol;
+         if (map_cols%2) lowfirstcol = !lowfirstcol;
          break;
       case UpperRight:
          coord_origin = UpperLeft;
@@ -502,16 +875,22 @@ Grid::Grid(const map<string, string> &opt)
    }
  
    // adjust lowfirstcol if even cols and coordinate origin on the right
-   if ((coord_origin == UpperRight || coord_origin == LowerRight) && !(cols%2))
+   if ((coord_origin == UpperRight || coord_origin == LowerRight) &&
+       !(map_cols%2))
       lowfirstcol = !lowfirstcol;
 
    // there is no wave with only one column
-   if (cols == 1) lowfirstcol = false;
+   if (map_cols == 1) lowfirstcol = false;
+
+   // a viewport starting in an odd column starts out of step
+   if (view_col % 2) lowfirstcol = !lowfirstcol;
 
    // horizontal grain adjustments
    if (grain == Horizontal) {
       if (output == PS) swap(rows, cols);
       else if (output == PNG) {
+         // PNG hexes are laid out with vertical grain, and each point is
+         // turned into place as it is drawn
          swap(iw, ih);
       
          // rotate margins
@@ -533,31 +912,57 @@ Grid::Grid(const map<string, string> &opt)
       coord_tilt = fmod(coord_tilt, 360);
       if (coord_tilt < 0) coord_tilt += 360;  
    }
+
+   if (coord_display) compile_format();
 }
 
 
 void Grid::draw()
 {
-   switch (output) {
-   case SVG:   draw_svg(); break;
-   case PNG:   draw_png(); break;
-   case PS:    draw_ps();  break;
+   if (tiled) pyramid_png();
+   else if (outfile.empty() || outfile == "-") draw(cout);
+   else {
+      ofstream out(outfile.c_str(), ios::out | ios::binary);
+      if (!out) throw runtime_error("cannot write to " + outfile);
+
+      draw(out);
+
+      out.close();
+      if (!out) throw runtime_error("error writing " + outfile);
    }
 }
 
 
-string Grid::alpha(int m)
+void Grid::draw(ostream &os)
 {
-   // A ... Z AA AB ...
-   if (m < 27) return string(1, m > 0 ? m+64 : 'Z');
-   else return alpha((m-1)/26) + string(1, m % 26 ? (m % 26) + 64 : 'Z');
+   if (tiled) throw runtime_error("tile output cannot go to a stream");
+
+   if (cache_dir.empty()) render(os);
+   else draw_cached(os);
 }
 
 
-string Grid::alpha_tally(int m)
+void Grid::render(ostream &os)
 {
-   // A ... Z AA BB ...
-   return string(int(ceil(m/26.0)), (m-1) % 26 + 65);
+   if (gzip) {
+      GzipBuf z(os.rdbuf());
+      ostream out(&z);
+
+      switch (output) {
+      case SVG:   draw_svg(out); break;
+      case PS:    draw_ps(out);  break;
+      default:    break;
+      }
+
+      if (!z.finish()) throw runtime_error("error writing gzip output");
+      return;
+   }
+
+   switch (output) {
+   case SVG:   draw_svg(os); break;
+   case PNG:   draw_png(os); break;
+   case PS:    draw_ps(os);  break;
+   }
 }
 
 
@@ -602,11 +1007,6 @@ void Grid::parse_color(const char *o, const string &str, string &c)
 
 void Grid::parse_opacity(const char *o, const string &str, double &op)
 {
-   if (output == PS) {
-      cerr << "opacity ignored for PostScript output" << endl; 
-      return;
-   }
-
    try {
       op = lexical_cast<double>(str);
    }
@@ -614,16 +1014,33 @@ void Grid::parse_opacity(const char *o, const string &str, double &op)
       throw runtime_error(string(o) + " is not a number");
    }
 
+   if (op < 0) throw range_error(string(o) + " is negative");
+}
+
+
+void Grid::check_opacity(const char *o, double &op)
+{
+   // NB: this works because 0 is opaque in PNG, 1 is opaque in SVG, and
+   // opacity is ignored in PostScript.
+   if (op < 0) {
+      op = (output == SVG);
+      return;
+   }
+
    if (output == PNG) {
-      if (op < 0 || op > 127) throw range_error(string(o) +
+      if (op > 127) throw range_error(string(o) +
          " is not in the allowable range [0,127] for PNG output");
       if (op != floor(op)) throw runtime_error(string(o) +
          " is not an integer");
    }
    else if (output == SVG) {
-      if (op < 0 || op > 1) throw range_error(string(o) +
+      if (op > 1) throw range_error(string(o) +
          " is not in the allowable range [0,1] for SVG output");
    }
+   else {
+      cerr << "opacity ignored for PostScript output" << endl; 
+      op = 0;
+   }
 }
 
 
@@ -738,3 +1155,37 @@ void Grid::parse_format(const string &str)
 
    if (!i.eof()) throw runtime_error("bad coordinate format string");   
 }
+
+
+void Grid::compile_format()
+{
+   static const LabelFormat::Style style[] = {
+      LabelFormat::Number, LabelFormat::Number,
+      LabelFormat::Alpha, LabelFormat::AlphaTally
+   };
+
+   // number map columns and rows away from the origin
+   const bool right = coord_origin == UpperRight || coord_origin == LowerRight,
+              low = coord_origin == LowerLeft || coord_origin == LowerRight;
+   labels.number(right ? map_cols-1+int(coord_cstart) : int(coord_cstart),
+                 right ? -1 : 1,
+                 low ? map_rows-1+int(coord_rstart) : int(coord_rstart),
+                 low ? -1 : 1);
+
+   const bool rows_first = coord_order == RowsFirst;
+
+   labels.add_text(coord_fmt_pre);
+   if (coord_first_style != NoCoord) {
+      labels.add_coord(rows_first, style[coord_first_style],
+                       coord_first_width, coord_first_fill);
+   }
+
+   labels.add_text(coord_fmt_inter);
+
+   // a zero fill given for the first coordinate holds for the second too
+   if (coord_second_style != NoCoord) {
+      labels.add_coord(!rows_first, style[coord_second_style],
+                       coord_second_width,
+                       coord_second_fill || coord_first_fill);
+   }
+}
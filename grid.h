@@ -20,64 +20,122 @@
 #ifndef __GRID_H_
 #define __GRID_H_
 
+#include <atomic>
+#include <exception>
 #include <map>
+#include <ostream>
 #include <string>
 using namespace std;
 
+#include "hexlayout.h"
+#include "label.h"
+
+struct GridOptions;
+struct PngShared;
+class Raster;
+struct Ramp;
+
 class Grid {
    public:
       Grid(const map<string, string> &opt);
+      Grid(const GridOptions &opt);
+
+      // draw to the output file, or to stdout if there is none
       void draw();
 
+      // draw to a stream; tiles, being many files, cannot be
+      void draw(ostream &os);
+
+      // a digest of what is drawn, the same for any options which draw
+      // the same image with the same version of mkhexgrid
+      string digest() const;
+
+      // the area of the image drawn, and the number of hexes in it
+      double area() const { return iw*ih; }
+      unsigned long hexes() const { return (unsigned long) cols*rows; }
+
    private:
+      // draw to a stream, whether or not the grid is in the cache
+      void render(ostream &os);
+
+      // cache functions
+      void draw_cached(ostream &os);
+
       // PNG-specific functions
-      void draw_png();
-      void side_png(int n);
-      void side_reverse_png(int n);
-      void side_skip_png(int n);
-      void edge_png(int n);
-      void edge_reverse_png(int n);
-      void cross_png(int c, int r);
-      void dot_png(int c, int r);
-      void line_png(int x1, int y1, int x2, int y2, int c);
-      void pixel_png(int x, int y, int c);
+      void draw_png(ostream &out);
+      void pyramid_png();
+      void zoom_png(PngShared *shared, int z, int nx, int ny, bool labels,
+                    atomic<int> *next, exception_ptr *err);
+      void colors_png();
+      void font_png();
+      void band_png(PngShared *shared, Raster *raster, int y1, int y2,
+                    exception_ptr *err);
+      void marker_png();
+      void stamp_png();
+      void tile_png(Raster *tile, int x, int y);
+      void near_png(double m, int &c1, int &c2, int &r1, int &r2);
+      void hexes_png(bool whole);
+      void cross_png(double cx, double cy);
+      void dot_png(double cx, double cy);
+      void line_png(double x1, double y1, double x2, double y2,
+                    const Ramp &c);
+      void coord_png(int col, int row);
 
       // PS-specific functions
-      void draw_ps();
+      void draw_ps(ostream &os);
 
       // SVG-specific functions
-      void draw_svg();
-      void side_path_svg(int n);
-      void side_path_reverse_svg(int n);
-      void side_skip_path_svg(int n);
-      void edge_path_svg(int n);
-      void edge_path_reverse_svg(int n);
+      void draw_svg(ostream &os);
+      void sides_svg(const HexMesh &m, const vector<unsigned int> &sides);
+      void pattern_svg();
+
+      // check what the options give, fill in the defaults which depend on
+      // the output type and work out the sizes; view is the viewport, as
+      // column, row, columns and rows, or 0 for none
+      void settle(bool centered, const long long *view);
 
       // parse functions
       void parse_length(const char *o, const string &str, double &d);
       void parse_color(const char *o, const string &str, string &c);
       void parse_opacity(const char *o, const string &str, double &op);
+      void check_opacity(const char *o, double &op);
       void parse_format(const string &str);
-
-      // utilty functions
-      string alpha(int m);
-      string alpha_tally(int m);
+      void compile_format();
 
       // image parameters
       enum OutputType { PNG, PS, SVG } output;  // output type
-      string outfile;   // output filename
+      bool tiled;       // PNG output as a pyramid of tiles
+      string outfile;   // output filename, or directory for tiles
+      string cache_dir; // where grids drawn before are kept, if anywhere
 
       double bg_opacity;        // background opacity
 
       double grid_thickness,    // hex grid line width
              grid_opacity;      // hex grid opacity
 
+      int precision;          // decimal places in SVG and PostScript,
+                              // or negative for six significant digits
+
+      unsigned int threads;   // worker threads for drawing
+      unsigned int strip;     // scanlines drawn at once
+
+      int png_level,          // PNG compression level
+          png_filter,         // PNG filter type, as PngWriter::Filter
+          png_color;          // PNG pixel format, as Raster::Format
+      bool png_parallel;      // deflate PNG in pieces, one per thread
+
       bool antialiased,  // antiailiasing
            lowfirstcol,  // first column is high or low
-           matte;        // matte around background
+           matte,        // matte around background
+           stamping;     // stamp the interior of the grid with tiles
 
       enum Grain { Vertical, Horizontal } grain;
 
+      bool svg_pattern;   // SVG grid as a pattern, not row by row
+      bool svg_label_runs;   // SVG labels a row to an element
+      bool gzip;          // SVG and PostScript gzipped as written
+      bool ps_label_proc;    // PostScript labels made by the interpreter
+
       bool coord_display;        // display coordinates if true
 
       unsigned int coord_rskip,  // number every multiple of ith row
@@ -106,6 +164,8 @@ class Grid {
       bool coord_first_fill,    // 0-fill, first coordinate
            coord_second_fill;   // 0-fill, second coordinate
 
+      LabelFormat labels;       // the format, ready to write labels
+
       double coord_size,         // coordinate font size in points
              coord_bearing,      // coordinate bearing from hex center
              coord_dist,         // coordinate distance from hex center
@@ -136,6 +196,13 @@ class Grid {
       int rows,
           cols;
 
+      HexLayout layout;   // where the hexes drawn lie
+
+      int map_rows,       // rows and columns of the whole map, of which
+          map_cols,       // those drawn may be a viewport
+          view_row,       // first row and column of the viewport
+          view_col;
+
       // useful constants
       static const double rad;    // radians per degree
 };
@@ -0,0 +1,160 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <zlib.h>
+
+#include "gzipbuf.h"
+
+static const size_t BLOCK = 1 << 18;
+
+GzipBuf::GzipBuf(streambuf *dst, int level)
+ : dst(dst), fill(BLOCK), full(BLOCK), full_len(0), zout(1 << 16),
+   pending(false), last(false), failed(false)
+{
+   z.zalloc = Z_NULL;
+   z.zfree = Z_NULL;
+   z.opaque = Z_NULL;
+
+   // a window of 15 bits, plus 16 for a gzip header and trailer
+   if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+      throw runtime_error("cannot initialize zlib");
+
+   setp(&fill[0], &fill[0] + fill.size());
+   worker = thread(&GzipBuf::work, this);
+}
+
+
+GzipBuf::~GzipBuf()
+{
+   if (worker.joinable()) finish();
+}
+
+
+bool GzipBuf::finish()
+{
+   hand_over(true);
+   worker.join();
+   deflateEnd(&z);
+   return !failed;
+}
+
+
+GzipBuf::int_type GzipBuf::overflow(int_type c)
+{
+   if (!hand_over(false)) return traits_type::eof();
+   if (c != traits_type::eof()) sputc(c);
+   return traits_type::not_eof(c);
+}
+
+
+streamsize GzipBuf::xsputn(const char *s, streamsize n)
+{
+   streamsize done = 0;
+   while (done < n) {
+      if (pptr() == epptr() && !hand_over(false)) break;
+
+      const streamsize k = min<streamsize>(n - done, epptr() - pptr());
+      memcpy(pptr(), s + done, k);
+      pbump(k);
+      done += k;
+   }
+   return done;
+}
+
+
+bool GzipBuf::hand_over(bool l)
+{
+   unique_lock<mutex> lock(m);
+   while (pending) cv.wait(lock);
+
+   // after a failure nothing more is deflated, but the thread must still
+   // be told of the last block, to end
+   if (!failed) {
+      fill.swap(full);
+      full_len = pptr() - pbase();
+   }
+   else if (!l) return false;
+
+   last = l;
+   pending = true;
+   cv.notify_all();
+
+   setp(&fill[0], &fill[0] + fill.size());
+   return !failed;
+}
+
+
+void GzipBuf::work()
+{
+   bool done = false;
+   while (!done) {
+      unique_lock<mutex> lock(m);
+      while (!pending) cv.wait(lock);
+      done = last;
+      bool ok = !failed;
+      lock.unlock();
+
+      // the block is ours until pending is cleared, so the lock need not
+      // be held while it is deflated
+      if (ok) {
+         z.next_in = (Bytef *) &full[0];
+         z.avail_in = full_len;
+
+         const int flush = done ? Z_FINISH : Z_NO_FLUSH;
+         int ret = Z_OK;
+         try {
+            do {
+               z.next_out = &zout[0];
+               z.avail_out = zout.size();
+               ret = deflate(&z, flush);
+
+               const streamsize have = zout.size() - z.avail_out;
+               if (ret == Z_STREAM_ERROR ||
+                   dst->sputn((const char *) &zout[0], have) != have) {
+                  ok = false;
+                  break;
+               }
+            } while (z.avail_out == 0);
+
+            if (ok && done && (ret != Z_STREAM_END || dst->pubsync() == -1))
+               ok = false;
+         }
+         catch (...) {
+            // nothing thrown here can reach the thread drawing
+            ok = false;
+         }
+      }
+
+      lock.lock();
+      if (!ok) failed = true;
+      pending = false;
+      cv.notify_all();
+   }
+}
@@ -0,0 +1,80 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __GZIPBUF_H_
+#define __GZIPBUF_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <zlib.h>
+
+//
+// A stream buffer which writes what is written to it to another as gzip.
+// What is written is gathered into blocks, and a second thread deflates
+// each full block while the next is filled, so that drawing and
+// compressing overlap.
+//
+class GzipBuf : public streambuf {
+   public:
+      GzipBuf(streambuf *dst, int level = Z_DEFAULT_COMPRESSION);
+
+      // a stream not finished is finished here, with any error lost
+      ~GzipBuf();
+
+      // deflate what is left and end the gzip stream; false if anything
+      // could not be written
+      bool finish();
+
+   protected:
+      int_type overflow(int_type c);
+      streamsize xsputn(const char *s, streamsize n);
+
+   private:
+      GzipBuf(const GzipBuf &);
+      GzipBuf &operator=(const GzipBuf &);
+
+      // pass the block filled to the deflating thread, once it is done
+      // with the one before
+      bool hand_over(bool last);
+
+      // the deflating thread
+      void work();
+
+      streambuf *dst;
+      z_stream z;
+
+      vector<char> fill,        // the block being filled
+                   full;        // and the one being deflated
+      size_t full_len;
+      vector<unsigned char> zout;
+
+      mutex m;
+      condition_variable cv;
+      bool pending,             // full holds a block not yet deflated
+           last,                // which is the last
+           failed;              // a write to dst or deflate failed
+      thread worker;
+};
+
+#endif /* __GZIPBUF_H_ */
@@ -0,0 +1,227 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+#include "hexlayout.h"
+
+void HexMesh::clear()
+{
+   vx.clear();
+   vy.clear();
+   e1.clear();
+   e2.clear();
+   id.clear();
+   cx.clear();
+   cy.clear();
+   lx.clear();
+   ly.clear();
+}
+
+
+void HexMesh::chain(const vector<unsigned int> &sides,
+                    vector<vector<unsigned int> > &runs) const
+{
+   runs.clear();
+   const size_t n = sides.size();
+
+   // the sides at each vertex, those at vertex v being at[first[v]] to
+   // at[first[v+1]-1]
+   vector<size_t> first(vx.size() + 1, 0);
+   for (size_t i = 0; i < n; ++i) {
+      ++first[e1[sides[i]] + 1];
+      ++first[e2[sides[i]] + 1];
+   }
+   for (size_t v = 1; v < first.size(); ++v) first[v] += first[v-1];
+
+   vector<unsigned int> at(2*n);
+   vector<size_t> next(first.begin(), first.end() - 1);
+   for (size_t i = 0; i < n; ++i) {
+      at[next[e1[sides[i]]]++] = i;
+      at[next[e2[sides[i]]]++] = i;
+   }
+
+   vector<bool> used(n, false);
+   for (size_t i = 0; i < n; ++i) {
+      if (used[i]) continue;
+
+      // a run through a vertex with an odd number of sides ends there, so
+      // start from one if the side has one
+      unsigned int v = e1[sides[i]];
+      const unsigned int w = e2[sides[i]];
+      if ((first[v+1] - first[v]) % 2 == 0 && (first[w+1] - first[w]) % 2)
+         v = w;
+
+      runs.push_back(vector<unsigned int>(1, v));
+      vector<unsigned int> &run = runs.back();
+
+      for (size_t k = i; k < n; ) {
+         used[k] = true;
+         v = e1[sides[k]] == v ? e2[sides[k]] : e1[sides[k]];
+         run.push_back(v);
+
+         // go on by any side not yet taken
+         size_t j = first[v];
+         while (j < first[v+1] && used[at[j]]) ++j;
+         k = j < first[v+1] ? at[j] : n;
+      }
+   }
+}
+
+
+HexLayout::HexLayout()
+ : hw(0), hh(0), left(0), top(0), cols(0), nrows(0), low(0)
+{
+}
+
+
+HexLayout::HexLayout(double hw, double hh, double left, double top,
+                     int cols, int rows, bool lowfirstcol)
+ : hw(hw), hh(hh), left(left), top(top), cols(cols), nrows(rows),
+   low(lowfirstcol)
+{
+}
+
+
+void HexLayout::near(double x1, double y1, double x2, double y2, double m,
+                     int &c1, int &c2, int &r1, int &r2) const
+{
+   c1 = max(int(floor((x1 - m - left)/(0.75*hw))) - 1, 0);
+   c2 = min(int(ceil((x2 + m - left)/(0.75*hw))) + 1, cols-1);
+   r1 = max(int(floor((y1 - m - top)/hh)) - 1, 0);
+   r2 = min(int(ceil((y2 + m - top)/hh)) + 1, nrows-1);
+}
+
+
+bool HexLayout::outer(int c, int r, int s) const
+{
+   // the hexes beside this one in the next and last columns are half a
+   // hex lower, or higher
+   const int d = (c+low)%2 ? 0 : -1;
+
+   switch (s) {
+   case 0:  --c; r += d;     break;
+   case 1:  --r;             break;
+   case 2:  ++c; r += d;     break;
+   case 3:  ++c; r += d + 1; break;
+   case 4:  ++r;             break;
+   default: --c; r += d + 1; break;
+   }
+
+   return c < 0 || c >= cols || r < 0 || r >= nrows;
+}
+
+
+void HexLayout::build(int c1, int c2, int r1, int r2, bool whole,
+                      HexMesh &m) const
+{
+   m.clear();
+   if (c1 > c2 || r1 > r2) return;
+
+   // Vertices lie on a lattice, two points across for each column and two
+   // down for each row. Hex c, r has its left vertex at point 2c, 1 + 2r
+   // + its column's parity, and the rest around it. Each vertex is placed
+   // from its lattice point, so that every hex sharing it agrees exactly.
+   const int nk = 2*(c2-c1) + 4, nj = 2*(r2-r1) + 4;
+   m.index.assign(size_t(nk)*nj, -1);
+
+   m.lx.resize(nk);
+   for (int k = 2*c1; k < 2*c1 + nk; ++k)
+      m.lx[k - 2*c1] = (k/2*0.75 + k%2*0.25)*hw + left;
+
+   m.ly.resize(nj);
+   for (int j = 2*r1; j < 2*r1 + nj; ++j)
+      m.ly[j - 2*r1] = 0.5*j*hh + top;
+
+   if (whole) build_columns<true>(c1, c2, r1, r2, m);
+   else       build_columns<false>(c1, c2, r1, r2, m);
+}
+
+
+template <bool Whole>
+void HexLayout::build_columns(int c1, int c2, int r1, int r2,
+                              HexMesh &m) const
+{
+   const int nj = 2*(r2-r1) + 4;
+
+   for (int c = c1; c <= c2; ++c) {
+      // rows of the next column lie half a hex lower, or higher
+      const int p = (c+low)%2, d = p ? 0 : -1;
+      const int k = 2*(c-c1);
+      const double hx = x(c);
+
+      for (int r = r1; r <= r2; ++r) {
+         const int j = 1 + 2*(r-r1) + p;
+         const size_t at = size_t(k)*nj + j;
+
+         const unsigned int w  = vertex(m, at,        k,   j),
+                            nw = vertex(m, at+nj-1,   k+1, j-1),
+                            sw = vertex(m, at+nj+1,   k+1, j+1),
+                            ne = vertex(m, at+2*nj-1, k+2, j-1);
+
+         side(m, w, nw, side_id(c, r, 0));
+         side(m, nw, ne, side_id(c, r, 1));
+         side(m, w, sw, side_id(c, r, 5));
+
+         m.cx.push_back(hx);
+         m.cy.push_back(y(c, r));
+
+         if (!Whole) continue;
+
+         // all but the sides which no other hex has
+         const bool bottom = r == nrows-1,
+                    upper = c == cols-1 || r+d < 0,
+                    lower = c == cols-1 || r+d+1 > nrows-1;
+
+         if (bottom || upper || lower) {
+            const unsigned int se = vertex(m, at+2*nj+1, k+2, j+1),
+                               e  = vertex(m, at+3*nj,   k+3, j);
+
+            if (bottom) side(m, sw, se, side_id(c, r, 4));
+            if (upper)  side(m, e, ne, side_id(c, r, 2));
+            if (lower)  side(m, e, se, side_id(c, r, 3));
+         }
+      }
+   }
+}
+
+
+unsigned int HexLayout::vertex(HexMesh &m, size_t at, int k, int j)
+{
+   // k and j count from the block's first lattice point
+   int &v = m.index[at];
+   if (v < 0) {
+      v = int(m.vx.size());
+      m.vx.push_back(m.lx[k]);
+      m.vy.push_back(m.ly[j]);
+   }
+   return v;
+}
+
+
+void HexLayout::side(HexMesh &m, unsigned int a, unsigned int b,
+                     unsigned int id)
+{
+   m.e1.push_back(a);
+   m.e2.push_back(b);
+   m.id.push_back(id);
+}
@@ -0,0 +1,116 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __HEXLAYOUT_H_
+#define __HEXLAYOUT_H_
+
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+//
+// The vertices, sides and centers of a block of hexes, each held once,
+// with their coordinates in separate arrays.
+//
+struct HexMesh {
+   vector<double> vx, vy;           // vertices
+   vector<unsigned int> e1, e2;     // sides, from vertex e1 to vertex e2
+   vector<unsigned int> id;         // the grid's id for each side
+   vector<double> cx, cy;           // centers, a column at a time
+
+   vector<int> index;               // vertex at each point of the block's
+                                    // lattice, for finding shared ones
+   vector<double> lx, ly;           // where the lattice's points lie
+   void clear();
+
+   // The given sides joined end to end into as few runs as they make,
+   // each run the vertices along it. A run which ends where it began is
+   // closed, and has its first vertex again at its end.
+   void chain(const vector<unsigned int> &sides,
+              vector<vector<unsigned int> > &runs) const;
+};
+
+//
+// Where the hexes of a grid lie, laid out with vertical grain: columns
+// run down the image, each half a hex lower or higher than the last.
+// All of the output types place hexes from this, so the grid has the
+// same shape whatever it is drawn as.
+//
+class HexLayout {
+   public:
+      HexLayout();
+      HexLayout(double hw, double hh, double left, double top,
+                int cols, int rows, bool lowfirstcol);
+
+      int columns() const { return cols; }
+      int rows() const    { return nrows; }
+
+      // the center of hex c, r
+      double x(int c) const { return (c*0.75 + 0.5)*hw + left; }
+      double y(int c, int r) const {
+         return (0.5*(1+(c+low)%2)+r)*hh + top;
+      }
+
+      // Side s of hex c, r, counting 0 to 5 from the upper left side
+      // clockwise: upper left, top, upper right, lower right, bottom and
+      // lower left. The id belongs to the grid, not to a block of it, so
+      // a side shared by two blocks, as by two strips or two tiles, has the
+      // same id in both. Each side has one id, that of the hex which holds
+      // it in build().
+      unsigned int side_id(int c, int r, int s) const {
+         return 6*(unsigned int)(c*nrows + r) + s;
+      }
+
+      // the hex and side which a side id names
+      void side_of(unsigned int id, int &c, int &r, int &s) const {
+         s = id % 6;
+         c = id/6 / nrows;
+         r = id/6 % nrows;
+      }
+
+      // whether side s of hex c, r has no hex of the grid beyond it
+      bool outer(int c, int r, int s) const;
+
+      // the hexes, columns c1 to c2 and rows r1 to r2, which come within m
+      // of the box from x1, y1 to x2, y2
+      void near(double x1, double y1, double x2, double y2, double m,
+                int &c1, int &c2, int &r1, int &r2) const;
+
+      // The hexes from column c1 to c2 and row r1 to r2, in one pass. Each
+      // hex has its upper left, top and lower left sides, which between
+      // them make up every side in the grid. When whole, the sides which
+      // no hex in the grid has that way are added, closing the outline.
+      void build(int c1, int c2, int r1, int r2, bool whole,
+                 HexMesh &m) const;
+
+   private:
+      template <bool Whole>
+      void build_columns(int c1, int c2, int r1, int r2, HexMesh &m) const;
+
+      static unsigned int vertex(HexMesh &m, size_t at, int k, int j);
+      static void side(HexMesh &m, unsigned int a, unsigned int b,
+                       unsigned int id);
+
+      double hw, hh,          // hex width and height
+             left, top;       // where the grid's bounding box starts
+      int cols, nrows;
+      int low;                // 1 if the first column is low
+};
+
+#endif /* __HEXLAYOUT_H_ */
@@ -0,0 +1,215 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "label.h"
+
+LabelFormat::LabelFormat() : c0(0), dc(1), r0(0), dr(1) {}
+
+
+// text as a PostScript string
+static string ps_string(const string &s)
+{
+   string q = "(";
+   for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] == '(' || s[i] == ')' || s[i] == '\\') q += '\\';
+      q += s[i];
+   }
+   return q + ')';
+}
+
+
+void LabelFormat::add_text(const string &text)
+{
+   if (text.empty()) return;
+
+   // runs of text are copied at once
+   if (!steps.empty() && steps.back().kind == Step::Text) {
+      steps.back().text += text;
+      return;
+   }
+
+   Step s;
+   s.kind = Step::Text;
+   s.row = false;
+   s.width = 0;
+   s.fill = ' ';
+   s.text = text;
+   steps.push_back(s);
+}
+
+
+void LabelFormat::add_coord(bool row, Style style, unsigned int width,
+                            bool fill)
+{
+   Step s;
+   switch (style) {
+   case Number:     s.kind = Step::Number;     break;
+   case Alpha:      s.kind = Step::Alpha;      break;
+   case AlphaTally: s.kind = Step::AlphaTally; break;
+   }
+   s.row = row;
+   s.width = width;
+   s.fill = fill ? '0' : ' ';
+   steps.push_back(s);
+}
+
+
+void LabelFormat::number(int c0, int dc, int r0, int dr)
+{
+   this->c0 = c0;
+   this->dc = dc;
+   this->r0 = r0;
+   this->dr = dr;
+}
+
+
+void LabelFormat::format(int c, int r, string &out) const
+{
+   out.clear();
+
+   const int n[2] = { c0 + dc*c, r0 + dr*r };
+
+   // digits and letters are written backward from the end of buf
+   char buf[64];
+   char *const end = buf + sizeof(buf);
+
+   for (size_t i = 0; i < steps.size(); ++i) {
+      const Step &s = steps[i];
+      const int m = n[s.row];
+      char *p = end;
+
+      switch (s.kind) {
+      case Step::Text:
+         out += s.text;
+         break;
+
+      case Step::Number:
+         {
+            // padding goes before the sign, as iostreams put it
+            unsigned int u = m < 0 ? 0u - unsigned(m) : unsigned(m);
+            do *--p = '0' + u % 10; while (u /= 10);
+            if (m < 0) *--p = '-';
+            if (unsigned(end - p) < s.width)
+               out.append(s.width - (end - p), s.fill);
+            out.append(p, end);
+         }
+         break;
+
+      case Step::Alpha:
+         // A ... Z AA AB ..., with Z for anything less than A
+         if (m <= 0) *--p = 'Z';
+         for (int k = m; k > 0; k = (k-1)/26)
+            *--p = k % 26 ? k % 26 + 64 : 'Z';
+         out.append(p, end);
+         break;
+
+      case Step::AlphaTally:
+         // A ... Z AA BB ...
+         if (m > 0) out.append((m+25)/26, (m-1) % 26 + 65);
+         break;
+      }
+   }
+}
+
+
+string LabelFormat::postscript(const string &name) const
+{
+   ostringstream ps;
+
+   // each step appends to the label, as format does, so that it takes no
+   // more than a few strings however many hexes are labelled
+   ps <<
+"% a b -> ab\n"
+"/label_cat {\n"
+"   exch dup length 2 index length add string\n"
+"   dup dup 4 2 roll copy length 4 -1 roll putinterval\n"
+"} bind def\n"
+"\n"
+"% (n) width fill -> (n), padded to width with the fill character\n"
+"/label_pad {\n"
+"   3 1 roll 1 index length sub\n"
+"   dup 0 gt {\n"
+"      string 0 1 2 index length 1 sub { 1 index exch 4 index put } for\n"
+"      exch label_cat exch pop\n"
+"   } { pop exch pop } ifelse\n"
+"} bind def\n"
+"\n"
+"% n -> A ... Z AA AB ..., with Z for anything less than A\n"
+"/label_alpha {\n"
+"   dup 0 le { pop (Z) } {\n"
+"      () exch {\n"
+"         dup 0 le { pop exit } if\n"
+"         dup 1 sub 26 mod 65 add 1 string dup 0 4 -1 roll put\n"
+"         3 -1 roll label_cat exch 1 sub 26 idiv\n"
+"      } loop\n"
+"   } ifelse\n"
+"} bind def\n"
+"\n"
+"% n -> A ... Z AA BB ...\n"
+"/label_tally {\n"
+"   dup 0 le { pop () } {\n"
+"      dup 25 add 26 idiv string exch 1 sub 26 mod 65 add\n"
+"      0 1 3 index length 1 sub { 2 index exch 2 index put } for\n"
+"      pop\n"
+"   } ifelse\n"
+"} bind def\n"
+"\n"
+"% column row -> label\n"
+"/" << name << " {\n"
+"   " << dr << " mul " << r0 << " add /label_r exch def\n"
+"   " << dc << " mul " << c0 << " add /label_c exch def\n"
+"   ()\n";
+
+   for (size_t i = 0; i < steps.size(); ++i) {
+      const Step &s = steps[i];
+      const char *n = s.row ? "label_r" : "label_c";
+
+      ps << "   ";
+      switch (s.kind) {
+      case Step::Text:
+         ps << ps_string(s.text);
+         break;
+
+      case Step::Number:
+         ps << n << " 12 string cvs";
+         if (s.width > 1) ps << ' ' << s.width << ' ' << int(s.fill)
+                             << " label_pad";
+         break;
+
+      case Step::Alpha:
+         ps << n << " label_alpha";
+         break;
+
+      case Step::AlphaTally:
+         ps << n << " label_tally";
+         break;
+      }
+      ps << " label_cat\n";
+   }
+
+   ps <<
+"} bind def\n";
+
+   return ps.str();
+}
@@ -0,0 +1,72 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LABEL_H_
+#define __LABEL_H_
+
+#include <string>
+#include <vector>
+using namespace std;
+
+//
+// Writes the coordinate labels of hexes. The coordinate format is turned
+// once into a list of steps, each copying some text or writing a column
+// or row number, so that labelling a hex only runs through the steps.
+//
+class LabelFormat {
+   public:
+      enum Style { Number, Alpha, AlphaTally };
+
+      LabelFormat();
+
+      // text, written as it is
+      void add_text(const string &text);
+
+      // the column or row number, in the given style; numbers are padded
+      // to width, with zeros if fill is set and spaces otherwise
+      void add_coord(bool row, Style style, unsigned int width, bool fill);
+
+      // map column c is numbered c0 + dc*c, and map row r, r0 + dr*r
+      void number(int c0, int dc, int r0, int dr);
+
+      // the label of map column c and row r, replacing what out held
+      void format(int c, int r, string &out) const;
+
+      // PostScript defining a procedure of the given name which does what
+      // format does, taking map column and row from the stack and leaving
+      // the label there, along with the procedures it uses
+      string postscript(const string &name) const;
+
+   private:
+      struct Step {
+         enum Kind { Text, Number, Alpha, AlphaTally } kind;
+         bool row;               // which number a coordinate step writes
+         unsigned int width;
+         char fill;
+         string text;
+      };
+
+      vector<Step> steps;
+      int c0, dc, r0, dr;
+};
+
+// the least k >= 0 for which n+k is a multiple of m
+inline int skip_to(unsigned int n, unsigned int m) { return (m - n % m) % m; }
+
+#endif /* __LABEL_H_ */
@@ -0,0 +1,186 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <map>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "grid.h"
+#include "libmkhexgrid.h"
+
+//
+// A stream buffer which appends what is written to it to a vector.
+//
+class VectorBuf : public streambuf {
+   public:
+      VectorBuf(vector<unsigned char> &buf) : buf(buf) {}
+
+   protected:
+      int_type overflow(int_type c) {
+         if (c != traits_type::eof()) buf.push_back(c);
+         return traits_type::not_eof(c);
+      }
+
+      streamsize xsputn(const char *s, streamsize n) {
+         buf.insert(buf.end(), s, s+n);
+         return n;
+      }
+
+   private:
+      vector<unsigned char> &buf;
+};
+
+
+const GridOptionName grid_option_names[] = {
+   { "hex-width",          true },
+   { "hex-height",         true },
+   { "hex-side",           true },
+   { "image-width",        true },
+   { "image-height",       true },
+   { "image-margin",       true },
+   { "rows",               true },
+   { "columns",            true },
+   { "viewport",           true },
+   { "grid-color",         true },
+   { "grid-opacity",       true },
+   { "grid-thickness",     true },
+   { "grid-grain",         true },
+   { "grid-start",         true },
+   { "coord-color",        true },
+   { "coord-opacity",      true },
+   { "coord-format",       true },
+   { "coord-font",         true },
+   { "coord-size",         true },
+   { "coord-bearing",      true },
+   { "coord-distance",     true },
+   { "coord-tilt",         true },
+   { "coord-column-skip",  true },
+   { "coord-row-skip",     true },
+   { "coord-column-start", true },
+   { "coord-row-start",    true },
+   { "coord-origin",       true },
+   { "bg-color",           true },
+   { "bg-opacity",         true },
+   { "matte",              false },
+   { "center-style",       true },
+   { "center-color",       true },
+   { "center-opacity",     true },
+   { "center-size",        true },
+   { "antialias",          false },
+   { "centered",           false },
+   { "threads",            true },
+   { "strip-height",       true },
+   { "stamp",              false },
+   { "png-compression",    true },
+   { "png-filter",         true },
+   { "png-color",          true },
+   { "png-deflate",        true },
+   { "precision",          true },
+   { "svg-grid",           true },
+   { "svg-labels",         true },
+   { "gzip",               false },
+   { "ps-labels",          true },
+   { "output",             true },
+   { "cache",              true },
+   { 0, false }
+};
+
+
+GridOptions::GridOptions()
+ : output(PNG),
+   hex_width(0), hex_height(0), hex_side(0),
+   image_width(0), image_height(0),
+   margin_top(0), margin_right(0), margin_bottom(0), margin_left(0),
+   centered(false),
+   columns(0), rows(0),
+   view_column(0), view_row(0), view_columns(0), view_rows(0),
+   grid_opacity(-1), grid_thickness(1),
+   horizontal(false), first_in(false),
+   coord_format("%02c%02r"), coord_opacity(-1),
+   coord_size(8), coord_bearing(90), coord_distance(0), coord_tilt(0),
+   coord_column_skip(1), coord_row_skip(1),
+   coord_column_start(1), coord_row_start(1),
+   coord_origin(UpperLeft),
+   bg_opacity(-1), matte(false),
+   center_style(Centerless), center_opacity(-1), center_size(3),
+   antialiased(false), threads(1), strip_height(2048), stamp(false),
+   png_compression(9), png_filter(Adaptive), png_color(Truecolor),
+   png_parallel(false),
+   precision(-1), svg_pattern(false), svg_label_runs(false),
+   gzip(false), ps_label_proc(false)
+{
+}
+
+
+void render_grid(const GridOptions &opt, vector<unsigned char> &buf)
+{
+   Grid g(opt);
+
+   buf.clear();
+   VectorBuf vb(buf);
+   ostream out(&vb);
+   g.draw(out);
+}
+
+
+void render_grid(const map<string, string> &opt, vector<unsigned char> &buf)
+{
+   // the image goes to the buffer, whatever file the options name
+   map<string, string> o(opt);
+   o.erase("outfile");
+
+   Grid g(o);
+
+   buf.clear();
+   VectorBuf vb(buf);
+   ostream out(&vb);
+   g.draw(out);
+}
+
+
+string grid_digest(const GridOptions &opt)
+{
+   return Grid(opt).digest();
+}
+
+
+string grid_digest(const map<string, string> &opt)
+{
+   return Grid(opt).digest();
+}
+
+
+void grid_extent(const GridOptions &opt, double &area, unsigned long &hexes)
+{
+   const Grid g(opt);
+   area = g.area();
+   hexes = g.hexes();
+}
+
+
+void grid_extent(const map<string, string> &opt, double &area,
+                 unsigned long &hexes)
+{
+   const Grid g(opt);
+   area = g.area();
+   hexes = g.hexes();
+}
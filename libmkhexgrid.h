@@ -0,0 +1,155 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __LIBMKHEXGRID_H_
+#define __LIBMKHEXGRID_H_
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+//
+// What to draw, as the options of the command line would give it. Each
+// option starts out with the default the command line gives it. Lengths
+// are in pixels, or in points for PostScript, and opacities are on the
+// scale the output type uses, 0 to 127 (transparent) for PNG and 0 to 1
+// (opaque) for SVG. Where a default depends on the output type, an empty
+// string or a negative number stands for it.
+//
+struct GridOptions {
+   enum Output { PNG, PS, SVG } output;
+
+   double hex_width,          // hex size; left at 0, each is worked out
+          hex_height,         // from the others and the image size
+          hex_side;
+
+   double image_width,        // image size; left at 0, each is worked out
+          image_height;       // from the hex size and the rows and columns
+
+   double margin_top,
+          margin_right,
+          margin_bottom,
+          margin_left;
+
+   bool centered;             // center the grid within the margins
+
+   int columns,               // left at 0, each is worked out from
+       rows;                  // the image and hex sizes
+
+   int view_column,           // a window onto the map; there is none
+       view_row,              // unless view_columns is positive
+       view_columns,
+       view_rows;
+
+   string grid_color;
+   double grid_opacity;
+   double grid_thickness;
+
+   bool horizontal;           // horizontal grain, not vertical
+   bool first_in;             // first column or row starts in, not out
+
+   string coord_format;       // empty for no coordinates
+   string coord_color;
+   double coord_opacity;
+   string coord_font;         // empty for the default font
+   double coord_size,
+          coord_bearing,
+          coord_distance,
+          coord_tilt;
+
+   unsigned int coord_column_skip,
+                coord_row_skip,
+                coord_column_start,
+                coord_row_start;
+
+   enum Origin { UpperLeft, UpperRight, LowerLeft, LowerRight } coord_origin;
+
+   string bg_color;
+   double bg_opacity;
+   bool matte;
+
+   enum Center { Centerless, Dot, Cross } center_style;
+   string center_color;
+   double center_opacity;
+   double center_size;
+
+   bool antialiased;
+   unsigned int threads,
+                strip_height;
+   bool stamp;
+
+   int png_compression;
+   enum Filter { None, Sub, Up, Average, Paeth, Adaptive } png_filter;
+   enum Color { Truecolor, Palette, Gray, Bilevel } png_color;
+   bool png_parallel;         // deflate PNG in pieces, one per thread
+
+   int precision;             // decimal places for PostScript and SVG,
+                              // or negative for six significant digits
+
+   bool svg_pattern;          // SVG grid as a pattern, not row by row
+   bool svg_label_runs;       // SVG labels a row to an element
+   bool gzip;                 // PostScript and SVG gzipped
+   bool ps_label_proc;        // PostScript labels made by the interpreter
+
+   string cache_dir;          // keep grids drawn here, if not empty
+
+   GridOptions();
+};
+
+//
+// The options which render_grid takes as strings, named as on the command
+// line, and whether each takes a value, ending with a null name.
+//
+struct GridOptionName {
+   const char *name;
+   bool value;
+};
+
+extern const GridOptionName grid_option_names[];
+
+//
+// Draws a grid in memory, replacing what buf holds with the PNG, SVG or
+// PostScript image. Errors are thrown as runtime_error. Grids may be drawn
+// from several threads at once.
+//
+void render_grid(const GridOptions &opt, vector<unsigned char> &buf);
+
+// the same, with options named and written as on the command line
+void render_grid(const map<string, string> &opt, vector<unsigned char> &buf);
+
+//
+// A digest naming the image which render_grid would draw, without drawing
+// it. Options which draw the same image have the same digest, so it can
+// stand for the image where one was drawn before, as an HTTP ETag does.
+//
+string grid_digest(const GridOptions &opt);
+string grid_digest(const map<string, string> &opt);
+
+//
+// How big the image which render_grid would draw is, without drawing it:
+// its area, in square pixels or, for PostScript, square points, and the
+// number of hexes in it.
+//
+void grid_extent(const GridOptions &opt, double &area,
+                 unsigned long &hexes);
+void grid_extent(const map<string, string> &opt, double &area,
+                 unsigned long &hexes);
+
+#endif /* __LIBMKHEXGRID_H_ */
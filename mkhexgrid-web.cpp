@@ -0,0 +1,699 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+//
+// mkhexgrid-web draws grids for HTTP clients on this machine, from a
+// process which keeps running, so that nothing is set up again for each
+// grid. A request names its options as a query string or a form, as
+//
+//    GET /?hex-side=20&columns=10&rows=8&output=svg
+//
+// and the image comes back as the body of the reply. GET /metrics gives
+// counts of the requests served and how long they took.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <boost/lexical_cast.hpp>
+using namespace boost;
+
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libmkhexgrid.h"
+#include "split.h"
+#include "urldecode.h"
+
+typedef chrono::steady_clock Clock;
+
+// requests larger than this are refused
+static const size_t max_request = 65536;
+
+void print_help();
+
+struct option long_options[] = {
+   { "port",             1, 0, 'p' },
+   { "socket",           1, 0, 's' },
+   { "threads",          1, 0, 't' },
+   { "queue",            1, 0, 'q' },
+   { "timeout",          1, 0, 'T' },
+   { "cache",            1, 0, 'c' },
+   { "max-area",         1, 0, 'A' },
+   { "max-hexes",        1, 0, 'H' },
+   { "max-threads",      1, 0, 'R' },
+   { "max-strip-height", 1, 0, 'S' },
+   { "help",             0, 0, 'h' },
+   { "version",          0, 0, 'v' },
+   { 0, 0, 0, 0 }
+};
+
+//
+// Connections accepted but not yet taken by a worker. There is room for
+// only so many; past that, clients are turned away at once rather than
+// left to wait behind grids which may take long to draw.
+//
+class Queue {
+   public:
+      Queue(size_t size) : size(size) {}
+
+      // false if the queue is full
+      bool push(int fd, Clock::time_point t);
+      void pop(int &fd, Clock::time_point &t);
+
+   private:
+      size_t size;
+      deque<pair<int, Clock::time_point> > q;
+      mutex lock;
+      condition_variable ready;
+};
+
+//
+// Counts of the requests served, and how long they took, from when each
+// was accepted to when its reply was sent.
+//
+class Metrics {
+   public:
+      Metrics();
+
+      void served(bool ok, double ms, double render_ms);
+      void rejected();
+      string report();
+
+   private:
+      static const int nbuckets = 6;
+      static const double bounds[nbuckets-1];   // in ms
+
+      unsigned long ok, failed, refused;
+      double total, render_total, worst;
+      unsigned long buckets[nbuckets];   // by the first bound not exceeded
+      mutex lock;
+};
+
+const double Metrics::bounds[] = { 1, 5, 10, 50, 100 };
+
+// what the workers serving requests share
+struct Service {
+   Queue *queue;
+   Metrics *metrics;
+   unsigned int timeout;   // in ms, or 0 for none
+   string cache_dir;       // where grids drawn are kept, if anywhere
+
+   // the most any one request may draw, or have drawing it
+   double max_area;              // square pixels or points
+   unsigned long max_hexes;
+   unsigned int max_threads,
+                max_strip;       // scanlines drawn at once
+};
+
+static string reason(int status)
+{
+   switch (status) {
+   case 200: return "OK";
+   case 304: return "Not Modified";
+   case 400: return "Bad Request";
+   case 404: return "Not Found";
+   case 405: return "Method Not Allowed";
+   case 408: return "Request Timeout";
+   case 413: return "Payload Too Large";
+   case 503: return "Service Unavailable";
+   default:  return "Error";
+   }
+}
+
+static bool send_all(int fd, const char *buf, size_t len)
+{
+   while (len) {
+      const ssize_t n = send(fd, buf, len, 0);
+      if (n <= 0) return false;
+      buf += n;
+      len -= n;
+   }
+   return true;
+}
+
+static bool reply(int fd, int status, const string &type,
+                  const char *body, size_t len, const string &extra = "")
+{
+   ostringstream head;
+   head << "HTTP/1.0 " << status << ' ' << reason(status) << "\r\n"
+           "Content-Type: " << type << "\r\n"
+           "Content-Length: " << len << "\r\n"
+        << extra
+        << "Connection: close\r\n\r\n";
+
+   const string h = head.str();
+   return send_all(fd, h.data(), h.size()) && send_all(fd, body, len);
+}
+
+static bool reply(int fd, int status, const string &msg)
+{
+   const string body = msg + "\n";
+   return reply(fd, status, "text/plain", body.data(), body.size());
+}
+
+// Closing a socket with the request still unread would reset it, and the
+// client might never see the reply, so read what has come in first.
+static void linger_close(int fd)
+{
+   char chunk[4096];
+   shutdown(fd, SHUT_WR);
+   while (recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT) > 0);
+   close(fd);
+}
+
+
+bool Queue::push(int fd, Clock::time_point t)
+{
+   lock_guard<mutex> hold(lock);
+   if (q.size() >= size) return false;
+   q.push_back(make_pair(fd, t));
+   ready.notify_one();
+   return true;
+}
+
+
+void Queue::pop(int &fd, Clock::time_point &t)
+{
+   unique_lock<mutex> hold(lock);
+   while (q.empty()) ready.wait(hold);
+   fd = q.front().first;
+   t = q.front().second;
+   q.pop_front();
+}
+
+
+Metrics::Metrics()
+ : ok(0), failed(0), refused(0), total(0), render_total(0), worst(0)
+{
+   fill(buckets, buckets+nbuckets, 0);
+}
+
+
+void Metrics::served(bool good, double ms, double render_ms)
+{
+   lock_guard<mutex> hold(lock);
+   ++(good ? ok : failed);
+   total += ms;
+   render_total += render_ms;
+   worst = max(worst, ms);
+
+   int b = 0;
+   while (b < nbuckets-1 && ms > bounds[b]) ++b;
+   ++buckets[b];
+}
+
+
+void Metrics::rejected()
+{
+   lock_guard<mutex> hold(lock);
+   ++refused;
+}
+
+
+string Metrics::report()
+{
+   lock_guard<mutex> hold(lock);
+   const unsigned long n = ok + failed;
+
+   ostringstream s;
+   s << "requests_ok " << ok << "\n"
+        "requests_failed " << failed << "\n"
+        "requests_refused " << refused << "\n"
+        "latency_ms_mean " << (n ? total/n : 0) << "\n"
+        "latency_ms_max " << worst << "\n"
+        "render_ms_mean " << (n ? render_total/n : 0) << "\n";
+
+   // each bucket counts the requests no slower than its bound
+   unsigned long within = 0;
+   for (int b = 0; b < nbuckets; ++b) {
+      within += buckets[b];
+      s << "latency_ms_bucket{le=\"";
+      if (b < nbuckets-1) s << bounds[b];
+      else s << "+Inf";
+      s << "\"} " << within << "\n";
+   }
+
+   return s.str();
+}
+
+
+// the value of the named header of a request head, or empty if it has none
+static string header(const string &head, const string &name)
+{
+   const vector<string> lines = split(head, '\n');
+   for (size_t i = 1; i < lines.size(); ++i) {
+      const string &line = lines[i];
+      if (line.size() <= name.size() || line[name.size()] != ':' ||
+          strncasecmp(line.c_str(), name.c_str(), name.size())) continue;
+
+      string v = line.substr(name.size() + 1);
+      v.erase(0, v.find_first_not_of(" \t"));
+      v.erase(v.find_last_not_of(" \t\r") + 1);
+      return v;
+   }
+   return "";
+}
+
+
+// Read the request head, and its body if it has one. False if the client
+// went away or took too long.
+static bool read_request(int fd, string &head, string &body, int &status)
+{
+   string buf;
+   char chunk[4096];
+   string::size_type end;
+   size_t want = 0;
+
+   while (true) {
+      if ((end = buf.find("\r\n\r\n")) != string::npos) {
+         if (!want) {
+            head = buf.substr(0, end);
+            want = end + 4;
+
+            // the body runs for as long as the head says it does
+            const string len = header(head, "content-length");
+            if (!len.empty()) {
+               try {
+                  want += lexical_cast<size_t>(len);
+               }
+               catch (bad_lexical_cast &) {
+                  status = 400;
+                  return false;
+               }
+            }
+         }
+
+         if (want > max_request) {
+            status = 413;
+            return false;
+         }
+
+         if (buf.size() >= want) {
+            body = buf.substr(end + 4, want - (end + 4));
+            return true;
+         }
+      }
+      else if (buf.size() > max_request) {
+         status = 413;
+         return false;
+      }
+
+      const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+         status = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 408 : 0;
+         return false;
+      }
+      buf.append(chunk, n);
+   }
+}
+
+
+static void parse_params(const string &str, map<string, string> &opt)
+{
+   if (str.empty()) return;
+
+   const vector<string> params = split(str, '&');
+   for (size_t i = 0; i < params.size(); ++i) {
+      const string &p = params[i];
+      if (p.empty()) continue;
+      const string::size_type eq = p.find('=');
+      const string key = urldecode(p.substr(0, eq)),
+                   val = eq == string::npos ? "" : urldecode(p.substr(eq+1));
+
+      // grids are only ever drawn to the reply
+      if (key == "outfile" || key == "infile" || key == "batch" ||
+          key == "cache" || key == "digest")
+         throw runtime_error("option `" + key + "' is not allowed");
+
+      const GridOptionName *o = grid_option_names;
+      while (o->name && key != o->name) ++o;
+      if (!o->name) throw runtime_error("unrecognized option `" + key + "'");
+
+      opt[key] = val;
+   }
+}
+
+
+// Why a grid is more than the server will draw, or empty if it is not, so
+// that no one request can take all of its memory or time. The options
+// have been checked already.
+static string over_limit(const map<string, string> &opt,
+                         const Service *svc)
+{
+   double area;
+   unsigned long hexes;
+   grid_extent(opt, area, hexes);
+
+   if (area > svc->max_area)
+      return "image is larger than " +
+             lexical_cast<string>(svc->max_area) + " square pixels";
+   if (hexes > svc->max_hexes)
+      return "grid has more than " +
+             lexical_cast<string>(svc->max_hexes) + " hexes";
+
+   map<string, string>::const_iterator i = opt.find("threads");
+   if (i != opt.end() &&
+       lexical_cast<unsigned int>(i->second) > svc->max_threads)
+      return "more than " + lexical_cast<string>(svc->max_threads) +
+             " threads asked for";
+
+   i = opt.find("strip-height");
+   if (i != opt.end() &&
+       lexical_cast<unsigned int>(i->second) > svc->max_strip)
+      return "strip height is more than " +
+             lexical_cast<string>(svc->max_strip);
+
+   return "";
+}
+
+
+static void serve(int fd, Clock::time_point accepted, const Service *svc)
+{
+   string head, body;
+   int status = 0;
+   double render_ms = 0;
+   bool ok = false;
+
+   // a client which waited too long for a worker has likely given up
+   const unsigned int timeout = svc->timeout;
+   if (timeout && Clock::now() - accepted > chrono::milliseconds(timeout)) {
+      reply(fd, 503, "timed out waiting to be served");
+   }
+   else if (!read_request(fd, head, body, status)) {
+      if (status) reply(fd, status, reason(status));
+   }
+   else {
+      // the request line is METHOD TARGET VERSION
+      const string line = head.substr(0, head.find("\r\n"));
+      istringstream s(line);
+      string method, target;
+      s >> method >> target;
+
+      const string::size_type q = target.find('?');
+      const string path = target.substr(0, q),
+                   query = q == string::npos ? "" : target.substr(q+1);
+
+      if (method != "GET" && method != "POST") {
+         reply(fd, 405, "only GET and POST are served");
+      }
+      else if (path == "/metrics") {
+         const string r = svc->metrics->report();
+         ok = reply(fd, 200, "text/plain", r.data(), r.size());
+      }
+      else if (path != "/") {
+         reply(fd, 404, "no such page");
+      }
+      else {
+         try {
+            map<string, string> opt;
+            parse_params(query, opt);
+            if (method == "POST") parse_params(body, opt);
+            if (!svc->cache_dir.empty()) opt["cache"] = svc->cache_dir;
+
+            const string out = opt.count("output") ? opt["output"] : "png";
+            const string type = out == "svg" ? "image/svg+xml" :
+                                out == "ps"  ? "application/postscript" :
+                                               "image/png";
+
+            // a client holding the image already need not be sent it
+            const string etag = '"' + grid_digest(opt) + '"';
+            const string match = header(head, "if-none-match");
+            const string over = over_limit(opt, svc);
+
+            if (!over.empty()) {
+               reply(fd, 413, over);
+            }
+            else if (match.find(etag) != string::npos || match == "*") {
+               ok = reply(fd, 304, type, NULL, 0,
+                          "ETag: " + etag + "\r\n");
+            }
+            else {
+               const Clock::time_point t = Clock::now();
+               vector<unsigned char> img;
+               render_grid(opt, img);
+               render_ms =
+                  chrono::duration<double, milli>(Clock::now() - t).count();
+
+               ostringstream extra;
+               extra << "ETag: " << etag << "\r\n"
+                        "X-Render-Time: " << render_ms << "ms\r\n";
+               if (opt.count("gzip") && out != "png")
+                  extra << "Content-Encoding: gzip\r\n";
+               ok = reply(fd, 200, type, (const char *) img.data(),
+                          img.size(), extra.str());
+            }
+         }
+         catch (std::exception &e) {
+            reply(fd, 400, e.what());
+         }
+      }
+   }
+
+   linger_close(fd);
+
+   svc->metrics->served(ok,
+      chrono::duration<double, milli>(Clock::now() - accepted).count(),
+      render_ms);
+}
+
+
+static void worker(const Service *svc)
+{
+   while (true) {
+      int fd;
+      Clock::time_point t;
+      svc->queue->pop(fd, t);
+      serve(fd, t, svc);
+   }
+}
+
+
+static int listen_on(int port, const string &path)
+{
+   int fd;
+
+   if (!path.empty()) {
+      sockaddr_un a;
+      memset(&a, 0, sizeof(a));
+      a.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(a.sun_path))
+         throw runtime_error("socket path `" + path + "' is too long");
+      strcpy(a.sun_path, path.c_str());
+
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) throw runtime_error("cannot create socket");
+      unlink(path.c_str());
+      if (bind(fd, (sockaddr *) &a, sizeof(a)))
+         throw runtime_error("cannot bind to `" + path + "'");
+   }
+   else {
+      // only clients on this machine are served
+      sockaddr_in a;
+      memset(&a, 0, sizeof(a));
+      a.sin_family = AF_INET;
+      a.sin_port = htons(port);
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0) throw runtime_error("cannot create socket");
+      const int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (bind(fd, (sockaddr *) &a, sizeof(a)))
+         throw runtime_error("cannot bind to port " +
+                             lexical_cast<string>(port));
+   }
+
+   if (listen(fd, 128)) throw runtime_error("cannot listen on socket");
+   return fd;
+}
+
+
+int main(int argc, char **argv)
+{
+   int port = 8080;
+   string path, cache_dir;
+   unsigned int threads = thread::hardware_concurrency(),
+                queue_size = 64,
+                timeout = 5000,
+                max_threads = 4,
+                max_strip = 2048;
+   double max_area = 4096.0*4096;
+   unsigned long max_hexes = 250000;
+   if (threads == 0) threads = 1;
+
+   try {
+      int c, option_index = 0;
+      while ((c = getopt_long(argc, argv, "", long_options,
+                              &option_index)) != -1) {
+         try {
+            switch (c) {
+            case 'p':
+               port = lexical_cast<int>(optarg);
+               if (port <= 0 || port > 65535)
+                  throw range_error("port is not between 1 and 65535");
+               break;
+            case 's':
+               path = optarg;
+               break;
+            case 't':
+               threads = lexical_cast<unsigned int>(optarg);
+               if (threads == 0)
+                  throw range_error("number of threads is not positive");
+               break;
+            case 'q':
+               queue_size = lexical_cast<unsigned int>(optarg);
+               break;
+            case 'T':
+               timeout = lexical_cast<unsigned int>(optarg);
+               break;
+            case 'c':
+               cache_dir = optarg;
+               break;
+            case 'A':
+               max_area = lexical_cast<double>(optarg);
+               if (max_area <= 0)
+                  throw range_error("largest area is not positive");
+               break;
+            case 'H':
+               max_hexes = lexical_cast<unsigned long>(optarg);
+               break;
+            case 'R':
+               max_threads = lexical_cast<unsigned int>(optarg);
+               break;
+            case 'S':
+               max_strip = lexical_cast<unsigned int>(optarg);
+               break;
+            case 'v':
+               cout << "mkhexgrid-web version " << VERSION << endl;
+               exit(0);
+            case 'h':
+               print_help();
+               exit(0);
+            default:
+               exit(1);    // getopt produces an error message
+            }
+         }
+         catch (bad_lexical_cast &) {
+            throw runtime_error(string(long_options[option_index].name) +
+                                " is not an integer");
+         }
+      }
+
+      if (optind < argc) throw runtime_error("too many arguments");
+
+      // a client going away while its reply is sent is not fatal
+      signal(SIGPIPE, SIG_IGN);
+
+      const int fd = listen_on(port, path);
+
+      Queue queue(queue_size);
+      Metrics metrics;
+
+      Service svc;
+      svc.queue = &queue;
+      svc.metrics = &metrics;
+      svc.timeout = timeout;
+      svc.cache_dir = cache_dir;
+      svc.max_area = max_area;
+      svc.max_hexes = max_hexes;
+      svc.max_threads = max_threads;
+      svc.max_strip = max_strip;
+
+      vector<thread> workers;
+      for (unsigned int k = 0; k < threads; ++k)
+         workers.push_back(thread(worker, &svc));
+
+      timeval tv;
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+
+      while (true) {
+         const int cfd = accept(fd, NULL, NULL);
+         if (cfd < 0) continue;
+
+         // a client which sends or reads too slowly is dropped
+         if (timeout) {
+            setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+         }
+
+         if (!queue.push(cfd, Clock::now())) {
+            reply(cfd, 503, "too many requests waiting");
+            linger_close(cfd);
+            metrics.rejected();
+         }
+      }
+   }
+   catch (std::exception &e) {
+      cerr << argv[0] << ": " << e.what() << endl;
+      exit(1);
+   }
+
+   return 0;
+}
+
+
+void print_help()
+{
+   cout <<
+"Usage: mkhexgrid-web [OPTION]...\n"
+"Draw hexagonal grids for HTTP clients on this machine.\n"
+"\n"
+"Grids are requested as GET /?OPTION=VALUE&..., or as a POSTed form,\n"
+"with the options of mkhexgrid. GET /metrics reports the requests served.\n"
+"\n"
+"Options:\n"
+"   --port=N          listen on localhost port N (default 8080)\n"
+"   --socket=PATH     listen on the Unix socket PATH instead\n"
+"   --threads=N       draw N grids at once (default: one per CPU)\n"
+"   --queue=N         turn clients away when N are waiting (default 64)\n"
+"   --timeout=MS      drop clients idle for MS milliseconds (default 5000)\n"
+"   --cache=DIR       keep grids drawn in DIR, to serve again undrawn\n"
+"   --max-area=N      refuse images of more than N square pixels\n"
+"                     (default 16777216)\n"
+"   --max-hexes=N     refuse grids of more than N hexes (default 250000)\n"
+"   --max-threads=N   refuse requests for more than N threads (default 4)\n"
+"   --max-strip-height=N\n"
+"                     refuse strips of more than N scanlines (default 2048)\n"
+"   --help            display this help and exit\n"
+"   --version         display version information and exit\n";
+}
@@ -17,13 +17,18 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <atomic>
 #include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 using namespace std;
 
 #include <boost/lexical_cast.hpp>
@@ -32,53 +37,39 @@ using namespace boost;
 #include <getopt.h>
 
 #include "grid.h"
+#include "libmkhexgrid.h"
 
 void parse_spec(istream &in, map<string, string> &opt);
+void read_spec(const string &file, map<string, string> &opt);
+int run_batch(const char *prog, map<string, string> opt);
 void print_help();
 
-struct option long_options[] = {
-   { "hex-width",          1, 0, 0 },
-   { "hex-height",         1, 0, 0 },
-   { "hex-side",           1, 0, 0 },
-   { "image-width",        1, 0, 0 },
-   { "image-height",       1, 0, 0 },
-   { "image-margin",       1, 0, 0 },
-   { "rows",               1, 0, 0 },
-   { "columns",            1, 0, 0 },
-   { "grid-color",         1, 0, 0 },
-   { "grid-opacity",       1, 0, 0 },
-   { "grid-thickness",     1, 0, 0 },
-   { "grid-grain",         1, 0, 0 },
-   { "grid-start",         1, 0, 0 },
-   { "coord-color",        1, 0, 0 },
-   { "coord-opacity",      1, 0, 0 },
-   { "coord-format",       1, 0, 0 },
-   { "coord-font",         1, 0, 0 },
-   { "coord-size",         1, 0, 0 },
-   { "coord-bearing",      1, 0, 0 },
-   { "coord-distance",     1, 0, 0 },
-   { "coord-tilt",         1, 0, 0 },
-   { "coord-column-skip",  1, 0, 0 },
-   { "coord-row-skip",     1, 0, 0 },
-   { "coord-column-start", 1, 0, 0 },
-   { "coord-row-start",    1, 0, 0 },
-   { "coord-origin",       1, 0, 0 },
-   { "bg-color",           1, 0, 0 },
-   { "bg-opacity",         1, 0, 0 },
-   { "matte",              0, 0, 0 },
-   { "center-style",       1, 0, 0 },
-   { "center-color",       1, 0, 0 },
-   { "center-opacity",     1, 0, 0 },
-   { "center-size",        1, 0, 0 },
-   { "antialias",          0, 0, 0 },
-   { "centered",           0, 0, 0 },
-   { "output",             1, 0, 0 },
+// the options of mkhexgrid itself, besides those for drawing
+static const option own_options[] = {
+   { "batch",              1, 0, 0 },
+   { "digest",             0, 0, 0 },
    { "outfile",            1, 0, 'o' },
    { "help",               0, 0, 'h' },
    { "version",            0, 0, 'v' },
    { 0, 0, 0, 0 }
 };
 
+// all of the options, those for drawing first, ending with a null one
+static vector<option> long_options;
+
+static void list_options()
+{
+   for (const GridOptionName *o = grid_option_names; o->name; ++o) {
+      const option opt = { o->name, o->value ? 1 : 0, 0, 0 };
+      long_options.push_back(opt);
+   }
+
+   for (const option *o = own_options; ; ++o) {
+      long_options.push_back(*o);
+      if (!o->name) break;
+   }
+}
+
 
 int main(int argc, char **argv)
 {
@@ -87,8 +78,11 @@ int main(int argc, char **argv)
    int c;
    int option_index = 0;
 
+   list_options();
+
    while (1) {
-      c = getopt_long(argc, argv, "i:o:", long_options, &option_index);
+      c = getopt_long(argc, argv, "i:o:", &long_options[0],
+                      &option_index);
       if (c == -1) break;  // end of options
 
       switch (c) {
@@ -113,6 +107,15 @@ int main(int argc, char **argv)
    }
 
    try {
+      // draw every grid listed in a manifest
+      if (opt.find("batch") != opt.end()) {
+         if (optind < argc || opt.find("infile") != opt.end() ||
+             opt.find("outfile") != opt.end())
+            throw runtime_error(
+               "batch mode takes its spec and output files from the manifest");
+         return run_batch(argv[0], opt);
+      }
+
       // get name of specfile, if given as a positional parameter
       if (optind < argc) {
          if (opt.find("infile") != opt.end())
@@ -132,21 +135,12 @@ int main(int argc, char **argv)
 
       // read and parse specfile
       map<string,string>::const_iterator i = opt.find("infile");
-      if (i != opt.end()) {
-         if (i->second == "-") parse_spec(cin, opt); 
-         else {
-            ifstream in;
-            in.open(i->second.c_str(), ios::in | ios::binary);
-            if (!in)
-             throw runtime_error("cannot read spec file `" + i->second + "'");
-            parse_spec(in, opt);
-            in.close();
-         }
-      } 
+      if (i != opt.end()) read_spec(i->second, opt);
    
-      // draw hex grid
+      // draw hex grid, or say which grid it would be
       Grid g(opt);
-      g.draw();
+      if (opt.find("digest") != opt.end()) cout << g.digest() << endl;
+      else g.draw();
    }
    catch (std::exception &e) {
       cerr << argv[0] << ": " << e.what() << endl;
@@ -157,6 +151,139 @@ int main(int argc, char **argv)
 }
 
 
+void read_spec(const string &file, map<string, string> &opt)
+{
+   if (file == "-") parse_spec(cin, opt); 
+   else {
+      ifstream in;
+      in.open(file.c_str(), ios::in | ios::binary);
+      if (!in) throw runtime_error("cannot read spec file `" + file + "'");
+      parse_spec(in, opt);
+      in.close();
+   }
+}
+
+
+// what the workers drawing a batch share
+struct Batch {
+   const char *prog;
+   const map<string, string> *opt;           // options for every grid
+   const vector<pair<string, string> > *jobs; // spec and output files
+   atomic<size_t> next;                      // the next job to take
+   atomic<int> failed;                       // jobs which failed
+   mutex report;
+};
+
+static void batch_worker(Batch *b)
+{
+   // a grid which fails is reported without stopping the rest
+   for (size_t j; (j = b->next++) < b->jobs->size(); ) {
+      const pair<string, string> &job = (*b->jobs)[j];
+      try {
+         map<string, string> o(*b->opt);
+         if (!job.second.empty()) o["outfile"] = job.second;
+         read_spec(job.first, o);
+
+         Grid g(o);
+         if (o.find("digest") != o.end()) {
+            const string d = g.digest();
+            lock_guard<mutex> hold(b->report);
+            cout << d << "  " << job.first << endl;
+            continue;
+         }
+
+         // A grid with no output file goes to stdout. It is drawn into a
+         // buffer first and written whole, so that grids drawn at once do
+         // not interleave there.
+         map<string, string>::const_iterator f = o.find("outfile"),
+                                             t = o.find("output");
+         if ((f == o.end() || f->second.empty() || f->second == "-") &&
+             (t == o.end() || t->second != "tiles")) {
+            ostringstream s;
+            g.draw(s);
+
+            lock_guard<mutex> hold(b->report);
+            cout << s.str() << flush;
+            if (!cout) throw runtime_error("error writing to stdout");
+         }
+         else g.draw();
+      }
+      catch (std::exception &e) {
+         lock_guard<mutex> hold(b->report);
+         cerr << b->prog << ": " << job.first << ": " << e.what() << endl;
+         ++b->failed;
+      }
+   }
+}
+
+
+int run_batch(const char *prog, map<string, string> opt)
+{
+   // Each line of the manifest names a spec file, and optionally the file
+   // to draw it to. Options given on the command line hold for every grid,
+   // and override those in the spec files.
+   vector<pair<string, string> > jobs;
+   {
+      const string manifest = opt["batch"];
+      ifstream file;
+      if (manifest != "-") {
+         file.open(manifest.c_str(), ios::in | ios::binary);
+         if (!file)
+            throw runtime_error("cannot read manifest `" + manifest + "'");
+      }
+      istream &in = manifest == "-" ? cin : file;
+
+      string line;
+      for (unsigned int n = 1; getline(in, line); ++n) {
+         if (line.find('#') != string::npos) line.erase(line.find('#'));
+
+         istringstream s(line);
+         string spec, out, extra;
+         if (!(s >> spec)) continue;
+         s >> out;
+         if (s >> extra) throw runtime_error("too many files in manifest at"
+            " line " + lexical_cast<string>(n));
+         if (spec == "-")
+            throw runtime_error("spec files in a manifest cannot be stdin");
+
+         jobs.push_back(make_pair(spec, out));
+      }
+   }
+   opt.erase("batch");
+
+   // --threads gives the number of grids drawn at once, each by one thread
+   unsigned int threads = 1;
+   map<string, string>::iterator t = opt.find("threads");
+   if (t != opt.end()) {
+      try {
+         threads = lexical_cast<unsigned int>(t->second);
+      }
+      catch (bad_lexical_cast &) {
+         throw runtime_error("number of threads is not an integer");
+      }
+      if (threads == 0) throw range_error("number of threads is not positive");
+      opt.erase(t);
+   }
+   threads = min(threads, (unsigned int) max(jobs.size(), size_t(1)));
+
+   // the workers take grids in turn until none are left
+   Batch b;
+   b.prog = prog;
+   b.opt = &opt;
+   b.jobs = &jobs;
+   b.next = 0;
+   b.failed = 0;
+
+   vector<thread> workers;
+   for (unsigned int k = 0; k < threads; ++k)
+      workers.push_back(thread(batch_worker, &b));
+
+   for (size_t k = 0; k < workers.size(); ++k) workers[k].join();
+
+   return b.failed ? 1 : 0;
+}
+
+
 void parse_spec(istream &in, map<string, string> &opt)
 {
    string key, val;
@@ -392,6 +519,8 @@ void print_help()
 "   --hex-height=LENGTH      set hex height to LENGTH\n"
 "   --columns=N              set number of hex columns to N\n"
 "   --rows=N                 set number of hex rows to N\n"
+"   --viewport=C,R,W,H       draw only W columns and H rows of the map,\n"
+"                            from column C and row R\n"
 "   --image-width=LENGTH     set image width to LENGTH\n"
 "   --image-height=LENGTH    set image height to LENGTH\n"
 "   --margin=LENGTH          set image margins to LENGTH\n"
@@ -422,7 +551,32 @@ void print_help()
 "   --center-size=SIZE       set hex center size to SIZE\n"
 "   --antialias              turn on antialiased output\n"
 "   --centered               center grid within the image margins\n"
-"   --output=TYPE            set output TYPE = png, ps, svg\n"
+"   --threads=N              draw PNG output with N threads\n"
+"   --strip-height=N         draw PNG output N scanlines at a time\n"
+"   --stamp                  stamp the inside of PNG grids with one tile\n"
+"   --png-compression=N      compress PNG output at level N (0-9)\n"
+"   --png-filter=TYPE        filter PNG rows with TYPE (none, sub, up,\n"
+"                            average, paeth, adaptive)\n"
+"   --png-color=TYPE         write PNG output as TYPE (truecolor, palette,\n"
+"                            gray, bilevel)\n"
+"   --png-deflate=TYPE       compress PNG output as one stream (serial), or\n"
+"                            in pieces, one per thread (parallel)\n"
+"   --precision=N            write PS and SVG numbers to N decimal places\n"
+"   --svg-grid=TYPE          draw SVG grids row by row (rows), or as one\n"
+"                            pattern the size of two hexes (pattern)\n"
+"   --svg-labels=TYPE        write SVG coordinates one to an element\n"
+"                            (hexes), or a row to an element (runs)\n"
+"   --gzip                   gzip PostScript and SVG output, as is done\n"
+"                            anyway for files named *.gz or *.svgz\n"
+"   --ps-labels=TYPE         write PostScript coordinates out (array), or\n"
+"                            have them made when printed (procedure)\n"
+"   --output=TYPE            set output TYPE = png, ps, svg, tiles\n"
+"   --batch=MANIFEST         draw every spec file listed in MANIFEST,\n"
+"                            --threads of them at once\n"
+"   --cache=DIR              keep grids drawn in DIR, and copy them from\n"
+"                            there when drawn again\n"
+"   --digest                 print the digest naming the grid in the\n"
+"                            cache, and do not draw it\n"
 "-o --outfile=FILE           set output filename to FILE\n"
 "   --help                   display this help and exit\n"
 "   --version                display version information and exit\n"
@@ -17,36 +17,409 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <iomanip>
 #include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
-#include <cstring>
 #include <sstream>
+#include <thread>
+#include <vector>
 using namespace std;
 
-#include <gd.h>
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
+#include "font.h"
 #include "grid.h"
+#include "pngwriter.h"
+#include "raster.h"
+
+// globals for PNG drawing, one set per worker thread
+thread_local Raster *im;
+thread_local HexMesh mesh;           // hexes near the raster being drawn
+thread_local vector<Segment> segs;   // antialiased segments to be stroked
+thread_local Text label;             // coordinate being drawn
+thread_local string label_text;      // and its text
+thread_local double ox,        // image x of the first pixel of im
+                    oy;        // image y of the first pixel of im
+thread_local bool clipped;     // skip what lies wholly inside the stamp
+
+// The interior of the grid repeats every two columns and every row, so it
+// can be stamped with copies of a prerendered tile. Tiles are rendered for
+// each sub-pixel phase at which they fall.
+struct Stamp {
+   int x1, y1, x2, y2;              // pixels stamped, none if x1 > x2
+   vector<int> xs, ys;              // first pixel of each tile column and
+                                    // row, and one past the last
+   vector<int> xp, yp;              // phase of each tile column and row
+   int np;                          // number of row phases
+   vector<shared_ptr<Raster> > tiles;  // a tile for each pair of phases
+};
+
+// Center markers are composited from sprites made before drawing starts.
+// A dot has the same pixels wherever it falls, but a cross is made for
+// each sub-pixel phase at which the centers fall.
+struct Markers {
+   Sprite dot;
+   int q;                           // phases per pixel, none if 0
+   int reach;                       // pixels from a cross sprite's edge to
+                                    // the pixel holding its center
+   map<pair<int, int>, Sprite> crosses;   // a cross for each phase
+};
+
+// What all of the threads drawing one image share. Each image has its
+// own, so that several may be drawn at once.
+struct PngShared {
+   Ramp bc,          // background color
+        mc,          // matte color
+        gc,          // grid color
+        tc,          // text color
+        cc;          // center color
+   Raster::Format format;  // pixel format of the image and its tiles
+   shared_ptr<Font> font;   // coordinate font
+   double coord_pad; // furthest a coordinate reaches from its hex
+   bool turned;      // horizontal grain, drawn a quarter turn clockwise
+   double turn_x;    // where the top of an unturned image lands when turned
+   Stamp stamp;
+   Markers marker;
+};
+
+thread_local PngShared *png;   // that of the image this thread draws
+
+// Hexes are laid out with vertical grain. For horizontal grain, each point
+// is turned as it is drawn, so the image is rendered in its final shape.
+// Points are then moved to where the raster being drawn lies.
+static inline void place_png(double &x, double &y)
+{
+   if (png->turned) {
+      const double t = x;
+      x = png->turn_x - y;
+      y = t;
+   }
 
-// globals for PNG drawing
-gdImagePtr im;
-double cx,        // current x 
-       cy;        // current y
-int bc,           // background color
-    gc,           // grid color
-    tc,           // text color
-    cc;           // center color
+   x -= ox;
+   y -= oy;
+}
 
-void Grid::draw_png()
+// the pixel nearest v, halves rounded up, so that a point lands on the
+// same pixel whether the raster drawn starts before or after it
+static inline int pixel_png(double v)
 {
-   // setup the image for GD
-   im = gdImageCreateTrueColor(int(round(iw)), int(round(ih)));
+   return int(floor(v + 0.5));
+}
+
+// whether a box, with a margin of m around it, lies wholly in the stamp
+static inline bool stamped_png(double x1, double y1, double x2, double y2,
+                               double m)
+{
+   const Stamp &stamp = png->stamp;
+
+   return clipped &&
+          min(x1, x2) - m >= stamp.x1 && max(x1, x2) + m <= stamp.x2 &&
+          min(y1, y2) - m >= stamp.y1 && max(y1, y2) + m <= stamp.y2;
+}
+
+// tiles of a pyramid are square, with sides of this many pixels
+static const int tile_size = 256;
+
+// labels set smaller than this many pixels are left off tiles
+static const double min_label = 6;
+
+static void make_dir(const string &dir)
+{
+#ifdef WIN32
+   if (_mkdir(dir.c_str()) && errno != EEXIST)
+#else
+   if (mkdir(dir.c_str(), 0777) && errno != EEXIST)
+#endif
+      throw runtime_error("cannot create directory " + dir);
+}
+
+
+void Grid::draw_png(ostream &out)
+{
+   PngShared shared;
+   png = &shared;
+
+   // setup the framebuffer
+   const int w = int(round(iw)),
+             h = int(round(ih));
+
+   png->turned = grain == Horizontal;
+   png->turn_x = h-1;
+   layout = HexLayout(hw, hh, mleft, mtop, cols, rows, lowfirstcol);
+
+   // a grayscale image has an alpha channel only when it is transparent
+   png->format = Raster::Format(png_color);
+   if (png->format == Raster::Gray && bg_opacity == 127)
+      png->format = Raster::GrayAlpha;
+   if (png->format == Raster::Bilevel && bg_opacity == 127)
+      throw runtime_error("bilevel PNG output cannot be transparent");
+
+   // only a strip of the image is held at once
+   Raster raster(png->turned ? h : w, png->turned ? w : h, int(strip),
+                 png->format);
    
-   // allocate colors
+   colors_png();
+
+   // anti-alias to the alpha channel if our background is transparent
+   if (bg_opacity == 127) raster.alpha_blending(false);
+
+   // indexed images need every color they may use beforehand
+   vector<unsigned char> palette;
+   if (png->format == Raster::Indexed || png->format == Raster::Bilevel) {
+      vector<Ramp *> grounds, inks;
+      grounds.push_back(&png->bc);
+      if (matte) grounds.push_back(&png->mc);
+      inks.push_back(&png->gc);
+      if (center_style != Centerless) inks.push_back(&png->cc);
+      if (coord_display) inks.push_back(&png->tc);
+
+      palette = Raster::palette(png->format, bg_opacity != 127, antialiased,
+                                grounds, inks);
+   }
+
+   if (coord_display) font_png();
+
+   marker_png();
+
+   png->stamp.x1 = png->stamp.y1 = 0;
+   png->stamp.x2 = png->stamp.y2 = -1;
+   if (stamping) stamp_png();
+
+   PngWriter writer(out, raster.width(), raster.height(), png->format,
+                    bg_opacity == 127, palette, png_level,
+                    PngWriter::Filter(png_filter),
+                    png_parallel ? threads : 1);
+
+   for (int y = 0; y < raster.height(); y = raster.last()+1) {
+      raster.window(y);
+
+      // split the strip into bands, one per thread
+      const int n = raster.last() - y + 1;
+      vector<int> bands;
+      for (int k = 0; k < int(threads); ++k) {
+         const int b = y + int((long long)n*k/threads);
+         if (bands.empty() || b > bands.back()) bands.push_back(b);
+      }
+      bands.push_back(raster.last()+1);
+
+      vector<exception_ptr> errs(bands.size()-1);
+      if (bands.size() == 2)
+         band_png(png, &raster, y, raster.last(), &errs[0]);
+      else {
+         vector<thread> workers;
+         for (size_t k = 0; k < bands.size()-1; ++k) {
+            workers.push_back(thread(&Grid::band_png, this, png, &raster,
+                                     bands[k], bands[k+1]-1, &errs[k]));
+         }
+
+         for (size_t k = 0; k < workers.size(); ++k) workers[k].join();
+      }
+
+      for (size_t k = 0; k < errs.size(); ++k)
+         if (errs[k]) rethrow_exception(errs[k]);
+
+      writer.write(raster);
+   }
+
+   writer.finish();
+}
+
+
+void Grid::pyramid_png()
+{
+   if (outfile.empty() || outfile == "-")
+      throw runtime_error("tile output needs a directory to write to");
+
+   PngShared shared;
+   png = &shared;
+
+   png->turned = grain == Horizontal;
+   png->format = Raster::RGBA;
+   colors_png();
+
+   png->stamp.x1 = png->stamp.y1 = 0;
+   png->stamp.x2 = png->stamp.y2 = -1;
+
+   // The deepest zoom level has the image at full size, and each one
+   // above it half the size of the one below, down to a single tile.
+   const double size = max(iw, ih);
+   int zmax = 0;
+   while (ldexp(double(tile_size), zmax) < round(size)) ++zmax;
+
+   // each zoom level is drawn from the geometry at its own scale
+   const double g[] = {
+      hw, hh, hs, iw, ih, mleft, mright, mtop, mbottom,
+      grid_thickness, center_size, coord_size, coord_dist
+   };
+   double *const v[] = {
+      &hw, &hh, &hs, &iw, &ih, &mleft, &mright, &mtop, &mbottom,
+      &grid_thickness, &center_size, &coord_size, &coord_dist
+   };
+   const size_t nv = sizeof(v)/sizeof(v[0]);
+
+   try {
+      make_dir(outfile);
+
+      for (int z = zmax; z >= 0; --z) {
+         const double f = ldexp(1.0, z - zmax);
+         for (size_t k = 0; k < nv; ++k) *v[k] = g[k]*f;
+
+         const int w = int(round(iw)),
+                   h = int(round(ih));
+         png->turn_x = h-1;
+         layout = HexLayout(hw, hh, mleft, mtop, cols, rows, lowfirstcol);
+
+         marker_png();
+
+         // labels too small to read are left off
+         const bool labels = coord_display && coord_size*96/72 >= min_label;
+         if (labels) font_png();
+
+         const int nx = ((png->turned ? h : w) + tile_size-1)/tile_size,
+                   ny = ((png->turned ? w : h) + tile_size-1)/tile_size;
+
+         ostringstream dir;
+         dir << outfile << '/' << z;
+         make_dir(dir.str());
+         for (int x = 0; x < nx; ++x) {
+            ostringstream d;
+            d << dir.str() << '/' << x;
+            make_dir(d.str());
+         }
+
+         // the workers take tiles in turn until none are left
+         atomic<int> next(0);
+         const unsigned int n = min(threads, (unsigned int)(nx*ny));
+         vector<exception_ptr> errs(n);
+         vector<thread> workers;
+
+         for (unsigned int k = 0; k < n; ++k) {
+            workers.push_back(thread(&Grid::zoom_png, this, png, z, nx, ny,
+                                     labels, &next, &errs[k]));
+         }
+         for (unsigned int k = 0; k < n; ++k) workers[k].join();
+
+         for (unsigned int k = 0; k < n; ++k)
+            if (errs[k]) rethrow_exception(errs[k]);
+      }
+   }
+   catch (...) {
+      for (size_t k = 0; k < nv; ++k) *v[k] = g[k];
+      throw;
+   }
+
+   for (size_t k = 0; k < nv; ++k) *v[k] = g[k];
+}
+
+
+void Grid::zoom_png(PngShared *shared, int z, int nx, int ny, bool labels,
+                    atomic<int> *next, exception_ptr *err)
+{
+   png = shared;
+
+   try {
+      Raster tile(tile_size, tile_size, tile_size);
+      const Ramp clear = Raster::ramp(0, 127);
+
+      const int w = int(round(png->turned ? ih : iw)),
+                h = int(round(png->turned ? iw : ih));
+
+      for (int k; (k = (*next)++) < nx*ny; ) {
+         const int tx = k / ny, ty = k % ny;
+
+         im = &tile;
+         ox = tx*tile_size;
+         oy = ty*tile_size;
+         clipped = false;
+
+         // the part of the tile which lies in the image
+         const int tw = min(tile_size, w - int(ox)),
+                   th = min(tile_size, h - int(oy));
+         const bool whole = tw == tile_size && th == tile_size;
+
+         // fill background, leaving what lies past the image transparent
+         tile.alpha_blending(false);
+         if (!whole) tile.fill(0, 0, tile_size-1, tile_size-1, clear);
+         tile.alpha_blending(bg_opacity != 127);
+
+         if (matte) {
+            tile.fill(0, 0, tw-1, th-1, png->mc);
+
+            double l = mleft, t = mtop,
+                   r = round(iw)-1-mright, b = round(ih)-1-mbottom;
+            place_png(l, t);
+            place_png(r, b);
+            tile.fill(int(min(l, r)), int(min(t, b)),
+                      int(max(l, r)), int(max(t, b)), png->bc);
+         }
+         else tile.fill(0, 0, tw-1, th-1, png->bc);
+
+         hexes_png(true);
+
+         if (labels) {
+            int c1, c2, r1, r2;
+            near_png(png->coord_pad, c1, c2, r1, r2);
+
+            // only every coord_rskip-th row and coord_cskip-th column
+            const int rs = skip_to(r1+view_row+coord_rstart, coord_rskip),
+                      cs = skip_to(c1+view_col+coord_cstart, coord_cskip);
+            for (int r = r1 + rs; r <= r2; r += coord_rskip) {
+               for (int c = c1 + cs; c <= c2; c += coord_cskip)
+                  coord_png(c, r);
+            }
+         }
+
+         // nothing is drawn past the image
+         tile.alpha_blending(false);
+         if (tw < tile_size)
+            tile.fill(tw, 0, tile_size-1, tile_size-1, clear);
+         if (th < tile_size)
+            tile.fill(0, th, tile_size-1, tile_size-1, clear);
+
+         ostringstream file;
+         file << outfile << '/' << z << '/' << tx << '/' << ty << ".png";
+
+         ofstream out(file.str().c_str(), ios::out | ios::binary);
+         if (!out) throw runtime_error("cannot write to " + file.str());
+
+         PngWriter writer(out, tile_size, tile_size, Raster::RGBA,
+                          bg_opacity == 127 || !whole,
+                          vector<unsigned char>(), png_level,
+                          PngWriter::Filter(png_filter), 1);
+         writer.write(tile);
+         writer.finish();
+
+         out.close();
+         if (!out) throw runtime_error("error writing " + file.str());
+      }
+   }
+   catch (...) {
+      segs.clear();
+      *err = current_exception();
+   }
+
+   im = 0;
+   ox = oy = 0;
+}
+
+
+void Grid::colors_png()
+{
    unsigned int c;
    istringstream s;
 
@@ -54,643 +427,478 @@ void Grid::draw_png()
    s.str(bg_color);
    s >> hex >> c;
    if (s.fail() || !s.eof()) throw runtime_error("bad background color");
-   bc = gdImageColorExactAlpha(im, (c >> 16) & 0xff, 
-                                   (c >>  8) & 0xff,
-                                    c        & 0xff,
-                                   (unsigned int)bg_opacity);
+   png->bc = Raster::ramp(c, (unsigned int)bg_opacity);
+
+   // A partly opaque background is seen over black, or over white when
+   // matted, as GD starts out. Settle its color now, since each strip is
+   // drawn over whatever the last one left.
+   if (bg_opacity > 0 && bg_opacity < 127) {
+      const unsigned int u = matte ? 255*(255 - png->bc.a[0]) : 0;
+      png->bc = Raster::ramp(((png->bc.pr[0] + u + 127)/255 << 16) |
+                        ((png->bc.pg[0] + u + 127)/255 << 8) |
+                         (png->bc.pb[0] + u + 127)/255, 0);
+   }
+
+   png->mc = Raster::ramp(0xffffff, 0);
+
    // grid color
    s.clear();
    s.str(grid_color);
    s >> hex >> c;
    if (s.fail() || !s.eof()) throw runtime_error("bad grid color");
-   gc = gdImageColorExactAlpha(im, (c >> 16) & 0xff, 
-                                   (c >>  8) & 0xff,
-                                    c        & 0xff,
-                                   (unsigned int)grid_opacity);
+   png->gc = Raster::ramp(c, (unsigned int)grid_opacity);
+
    // text color
    s.clear();
    s.str(coord_color);
    s >> hex >> c;
    if (s.fail() || !s.eof()) throw runtime_error("bad coordinate color");
-   tc = gdImageColorExactAlpha(im, (c >> 16) & 0xff,
-                                   (c >>  8) & 0xff,
-                                    c        & 0xff,
-                                   (unsigned int)coord_opacity);
+   png->tc = Raster::ramp(c, (unsigned int)coord_opacity);
 
    // center color
    s.clear();
    s.str(center_color);
    s >> hex >> c;
    if (s.fail() || !s.eof()) throw runtime_error("bad center color");
-   cc = gdImageColorExactAlpha(im, (c >> 16) & 0xff,
-                                   (c >>  8) & 0xff,
-                                    c        & 0xff,
-                                   (unsigned int)center_opacity);
+   png->cc = Raster::ramp(c, (unsigned int)center_opacity);
+}
 
-   // anti-alias to the alpha channel if our background is transparent
-   if (bg_opacity == 127) {
-      gdImageSaveAlpha(im, 1);
-      gdImageAlphaBlending(im, 0);
-   }
 
-   // fill background
-   if (matte) {
-      gdImageFilledRectangle(im, 0, 0, gdImageSX(im)-1, gdImageSY(im)-1,
-                             gdImageColorExactAlpha(im, 255, 255, 255 ,0));
-      gdImageFilledRectangle(im, int(mleft), int(mtop),
-                                 int(gdImageSX(im)-1-mright),
-                                 int(gdImageSY(im)-1-mbottom),
-                             bc);
+void Grid::font_png()
+{
+   // glyphs are rasterized once, on first use, and shared by the workers
+   png->font = Font::get(coord_font, coord_size, coord_tilt*rad, antialiased);
+
+   // the coordinates in the corners are the longest
+   double pad = 0;
+   Text text;
+   for (int i = 0; i < 4; ++i) {
+      labels.format(view_col + (i % 2 ? cols-1 : 0),
+                    view_row + (i / 2 ? rows-1 : 0), label_text);
+      png->font->layout(label_text, text);
+      pad = max(pad, double(text.r-text.l+1 + text.b-text.t+1));
    }
-   else 
-      gdImageFilledRectangle(im, 0, 0, gdImageSX(im)-1, gdImageSY(im)-1, bc);
- 
-   // NB: apparently thickness does nothing when AA is on
-   // FIXME: new AA line drawing doesn't respect thickness
-   gdImageSetThickness(im, (unsigned int)grid_thickness);
-
-   if (lowfirstcol) {
-      cx = mleft+0.25*hw, 
-      cy = mtop+0.5*hh;
-
-      // outline
-      for (int n = 1; n <= 2*cols-cols%2; ++n)
-         side_png(n);
-      for (int n = cols%2; n <= 2*rows-2+cols%2; ++n)
-         edge_png(n);
-      for (int n = 3+(cols%2); n <= 2*cols+1+2*(cols%2); ++n)
-         side_reverse_png(n);
-      for (int n = 0; n <= 2*rows-1; ++n)
-         edge_reverse_png(n);
-
-      double oy = cy;
-
-      for (int r = 0; r < rows - 1; ++r) {
-         // bottoms
-         cx = mleft+0.75*hw;
-         cy = oy;
-         for (int n = 0; n <= 2*cols-3; ++n) side_skip_png(n);
-
-         // tops
-         cx = mleft+0.25*hw;
-         cy = oy += hh;
-         for (int n = 1; n <= 2*cols - 1; ++n) side_png(n);
-      }
+   png->coord_pad = pad + coord_dist + 2;
+}
 
-      cx = mleft+0.75*hw;
-      cy = oy;
-      for (int n = 0; n <= 2*cols-3; ++n) side_skip_png(n);
-   }
-   else {
-      cx = mleft;
-      cy = mtop+0.5*hh;    
-
-      // outline
-      for (int n = 2; n <= 2*cols+2-(cols+1)%2; ++n)
-         side_png(n);
-      for (int n = 1-cols%2; n <= 2*rows-1-cols%2; ++n)
-         edge_png(n);
-      for (int n = 3*(cols%2); n <= 2*cols-1+2*(cols%2); ++n)
-         side_reverse_png(n);
-      for (int n = 0; n <= 2*rows-2; ++n)
-         edge_reverse_png(n);
-
-      double oy = cy = mtop+hh;
-      
-      for (int r = 0; r < rows - 1; ++r) {
-         // bottoms
-         cx = mleft+0.75*hw;
-         for (int n = 2; n <= 2*cols-1; ++n) side_skip_png(n);
-
-         // tops
-         cx = mleft+0.25*hw;
-         cy = oy;
-         for (int n = 3; n <= 2*cols + 1; ++n) side_png(n);
-
-         cy = oy += hh;
+
+void Grid::band_png(PngShared *shared, Raster *raster, int y1, int y2,
+                    exception_ptr *err)
+{
+   png = shared;
+   const Stamp &stamp = png->stamp;
+
+   // Draw the rows y1 to y2. Everything is clipped to the band, and
+   // nothing outside it is touched, so bands can be drawn concurrently
+   // and give the same pixels as drawing the whole image at once.
+   try {
+      Raster band(*raster, y1, y2);
+      im = &band;
+      ox = oy = 0;
+      clipped = stamp.x1 <= stamp.x2;
+
+      // fill background
+      if (matte) {
+         im->fill(0, 0, im->width()-1, im->height()-1, png->mc);
+
+         double l = mleft, t = mtop,
+                r = round(iw)-1-mright, b = round(ih)-1-mbottom;
+         place_png(l, t);
+         place_png(r, b);
+         im->fill(int(min(l, r)), int(min(t, b)),
+                  int(max(l, r)), int(max(t, b)), png->bc);
+      }
+      else if (clipped && stamp.y1 <= y2 && stamp.y2 >= y1) {
+         // the stamp will cover its own background
+         const int t = max(stamp.y1, y1), b = min(stamp.y2, y2);
+         if (t > y1) im->fill(0, y1, im->width()-1, t-1, png->bc);
+         im->fill(0, t, stamp.x1-1, b, png->bc);
+         im->fill(stamp.x2+1, t, im->width()-1, b, png->bc);
+         if (b < y2) im->fill(0, b+1, im->width()-1, y2, png->bc);
       }
-      
-      cx = mleft+0.75*hw;
-      cy = oy;
-      for (int n = 2; n <= 2*cols-1; ++n) side_skip_png(n);
-   } 
-
-   // draw centers
-   if (center_style != Centerless) {
-      switch (center_style) {
-      case Cross:
-         for (int r = 0; r < rows; ++r)
-            for (int c = 0; c < cols; ++c)
-               cross_png(c, r);
-         break;
-      case Dot:
-         for (int r = 0; r < rows; ++r)
-            for (int c = 0; c < cols; ++c)
-               dot_png(c, r);
-         break;
-      default:
-         break;
+      else im->fill(0, 0, im->width()-1, im->height()-1, png->bc);
+
+      hexes_png(true);
+
+      // stamp the interior over whatever was drawn there
+      if (clipped) {
+         const int j1 = upper_bound(stamp.ys.begin(), stamp.ys.end(), y1) -
+                        stamp.ys.begin() - 1;
+         for (int j = max(j1, 0); j < int(stamp.ys.size())-1 &&
+                                  stamp.ys[j] <= y2; ++j) {
+            const int t = max(stamp.ys[j], y1),
+                      b = min(stamp.ys[j+1]-1, y2);
+            for (size_t i = 0; i < stamp.xs.size()-1; ++i) {
+               im->blit(stamp.xs[i], t,
+                        *stamp.tiles[stamp.xp[i]*stamp.np + stamp.yp[j]],
+                        0, t - stamp.ys[j],
+                        stamp.xs[i+1] - stamp.xs[i], b - t + 1);
+            }
+         }
+      }
+
+      if (coord_display) {
+         // draw coordinates
+         int c1, c2, r1, r2;
+         near_png(png->coord_pad, c1, c2, r1, r2);
+
+         // only every coord_rskip-th row and coord_cskip-th column
+         const int rs = skip_to(r1+view_row+coord_rstart, coord_rskip),
+                   cs = skip_to(c1+view_col+coord_cstart, coord_cskip);
+         for (int r = r1 + rs; r <= r2; r += coord_rskip) {
+            for (int c = c1 + cs; c <= c2; c += coord_cskip)
+               coord_png(c, r);
+         }
       }
    }
+   catch (...) {
+      segs.clear();
+      *err = current_exception();
+   }
+}
 
-   if (coord_display) {
-      // draw coordinates
-      if (!antialiased) tc = -tc;  // text is AA unless the color is negative
 
-#ifdef WIN32
-      // our precompiled GD DLL doesn't have the right font path for
-      // Windows so we set the environment variable it uses here
-      putenv("GDFONTPATH=C:\\Windows\\Fonts");
-#endif
+// the phase of v when a pixel is split into q, and the pixel it is in
+static inline int phase_png(double v, int q, int &pixel)
+{
+   const long long k = (long long)floor(v*q + 0.5);
+   const int p = int(((k % q) + q) % q);
+   pixel = int((k - p)/q);
+   return p;
+}
 
-      gdFTUseFontConfig(1);
-
-      char fn[coord_font.length()+1];
-      memset(fn, '\0', coord_font.length()+1);
-      coord_font.copy(fn, coord_font.length());
-
-      double bcos = cos(coord_bearing*rad),
-             bsin = sin(coord_bearing*rad);
-
-      for (int r = 0; r < rows; ++r) {
-         if ((r+coord_rstart) % coord_rskip) continue;
-         for (int c = 0; c < cols; ++c) {
-            if ((c+coord_cstart) % coord_cskip) continue;
-
-            int cc = 0, cr = 0;
-
-            switch (coord_origin) {
-            case UpperLeft:
-               cc = c+coord_cstart;
-               cr = r+coord_rstart;
-               break;
-            case UpperRight:
-               cc = cols-c-1+coord_cstart;
-               cr = r+coord_rstart;
-               break;
-            case LowerLeft:
-               cc = c+coord_cstart;
-               cr = rows-r-1+coord_rstart;
-               break;
-            case LowerRight:
-               cc = cols-c-1+coord_cstart;
-               cr = rows-r-1+coord_rstart;
-               break;
-            }
 
-            int cnum = cc, rnum = cr;
-            if (coord_order == RowsFirst) swap(cnum, rnum);
-
-            ostringstream s;
-            s << coord_fmt_pre;
-
-            switch (coord_first_style) {
-            case NoCoord:
-               break;
-            case Number:
-               if (coord_first_width) s << setw(coord_first_width);
-               if (coord_first_fill) s << setfill('0');
-               s << cnum;
-               break;
-            case Alpha:
-               s << alpha(cnum);
-               break;
-            case AlphaTally:
-               s << alpha_tally(cnum);
-               break;
+void Grid::marker_png()
+{
+   Markers &marker = png->marker;
+
+   marker.q = 0;
+   marker.crosses.clear();
+
+   if (!antialiased) return;
+
+   if (center_style == Dot) {
+      // the offsets of the dot's pixels from its center are those of
+      // the pixels from the first one
+      vector<double> d;
+      for (double x = -center_size; x <= center_size; ++x) d.push_back(x);
+
+      const int n = d.size();
+      const double o2 = (center_size+1)*(center_size+1),
+                   i2 = center_size*center_size;
+      vector<unsigned char> level(size_t(n)*n, 127);
+
+      for (int i = 0; i < n; ++i) {
+         for (int j = 0; j < n; ++j) {
+            const double x2y2 = d[i]*d[i] + d[j]*d[j];
+            if (x2y2 < i2) level[j*n + i] = 0;           // interior pixel
+            else if (x2y2 < o2) {                        // edge pixel
+               level[j*n + i] = int(round((sqrt(x2y2)-center_size)*127));
             }
+         }
+      }
 
-            s << coord_fmt_inter;
-   
-            switch (coord_second_style) {
-            case NoCoord:
-               break;
-            case Number:
-               if (coord_second_width) s << setw(coord_second_width);
-               if (coord_second_fill) s << setfill('0');
-               s << rnum;
-               break;
-            case Alpha:
-               s << alpha(rnum);
-               break;
-            case AlphaTally:
-               s << alpha_tally(rnum);
-               break;
+      marker.dot = Raster::sprite(n, n, level, png->cc);
+   }
+   else if (center_style == Cross) {
+      // Crosses are stroked together with their neighbors, so a sprite
+      // can stand in for one only where the strokes cannot meet.
+      marker.reach = int(ceil(center_size + grid_thickness/2)) + 2;
+      if (2*marker.reach >= min(hh, 0.75*hw)) return;
+
+      // Centers in even and odd columns each fall at a few phases across
+      // and a few down, unless the hex size is awkward. Then they are
+      // drawn at the nearest fraction of a pixel which needs no more than
+      // 256 sprites, 1/16 at worst.
+      set<pair<int, int> > phases;
+      for (int q = 4096; q >= 16 && phases.empty(); q /= 4) {
+         size_t n = 0;
+         for (int p = 0; p < 2 && n <= 256; ++p) {
+            set<int> across, down;
+            int pixel;
+            for (int c = p; c < cols && across.size() <= 256; c += 2) {
+               across.insert(phase_png(layout.x(c), q, pixel));
             }
 
-            double x = (c*0.75 + 0.5)*hw+coord_dist*bcos;
-            double y = (r + 0.5*(1 + (c+lowfirstcol)%2))*hh+coord_dist*bsin;
-
-//            gdImageLine(im, round(x), round(y), round(x-coord_dist*bcos), round(y-coord_dist*bsin), 0);
-
-            char ct[s.str().length()+1];
-            memset(ct, '\0', s.str().length()+1);
-            s.str().copy(ct, s.str().length());
-   
-            char *err;
-            int br[8];        
-  
-            err = gdImageStringFT(NULL, br, tc, fn, coord_size,
-                                  coord_tilt*rad, 0, 0, ct);
-            if (err) throw runtime_error(err);
-   
-            int l = min(br[0], min(br[2], min(br[4], br[6]))),
-                r = max(br[0], max(br[2], max(br[4], br[6]))),
-                t = min(br[1], min(br[3], min(br[5], br[7]))),
-                b = max(br[1], max(br[3], max(br[5], br[7])));
-
-            int w = r-l+1,
-                h = b-t+1;
-
-            // we do this to avoid a bounding box bug in gd-2.0.33 
-            gdImagePtr tmp = gdImageCreateTrueColor(w, h);
-            gdImageSaveAlpha(tmp, 1);
-            gdImageAlphaBlending(tmp, 0);
-            gdImageFilledRectangle(tmp, 0, 0, w-1, h-1, 
-               gdImageColorExactAlpha(tmp, 0, 0, 0, 127));
-
-            /*
-             * works, but the min/max stuff above is simpler
-             * 
-            // find the offset of the upper left corner
-            // of the (orthogonal) bounding box
-            int bx = 0, by = 0;
-            if (0 <= coord_tilt && coord_tilt < 90) {
-               bx = -br[6];
-               by = -br[5];
-            }
-            else if (90 <= coord_tilt && coord_tilt < 180) {
-               bx = -br[4];
-               by = -br[3];
-            }
-            else if (180 <= coord_tilt && coord_tilt < 270) {
-               bx = -br[2];
-               by = -br[1];
-            }
-            else if (270 <= coord_tilt && coord_tilt < 360) {
-               bx = -br[0];
-               by = -br[7];
-            }
-            */
-
-            /*
-            // draw box around coordinates for debugging
-            gdPoint p[4];
-            p[0].x = bx+br[0];
-            p[0].y = by+br[1];
-            p[1].x = bx+br[2];
-            p[1].y = by+br[3];
-            p[2].x = bx+br[4];
-            p[2].y = by+br[5];
-            p[3].x = bx+br[6];
-            p[3].y = by+br[7];
-
-            cerr << p[0].x << ',' << p[0].y << ' '
-                 << p[1].x << ',' << p[1].y << ' '
-                 << p[2].x << ',' << p[2].y << ' '
-                 << p[3].x << ',' << p[3].y << ' '
-                 << bx << ',' << by << endl;
-
-            gdImagePolygon(tmp, p, 4, gdImageColorExactAlpha(tmp, 0, 0, 0, 0)); 
-            */
-
-            err = gdImageStringFT(tmp, NULL, tc, fn, coord_size,
-                                  coord_tilt*rad, br[0]-l, br[1]-t, ct);
-            if (err) throw runtime_error(err);
-   
-            // clip left of text to eliminate unused pixel columns
-            for (int i = 0; i < w; ++i) {
-               for (int j = 0; j < h; ++j) { 
-                  if (gdImageAlpha(im, gdImageGetPixel(tmp, i, j)) < 127) {
-                     l = i;
-                     goto LCLIP;
-                  }            
-               }
-            }
-            LCLIP:
-   
-            // clip right of text to eliminate unused pixel columns
-            for (int i = w-1; i >= 0; --i) {
-               for (int j = 0; j < h; ++j) { 
-                  if (gdImageAlpha(im, gdImageGetPixel(tmp, i, j)) < 127) {
-                     r = i;
-                     goto RCLIP;
-                  }            
-               }
-            }
-            RCLIP:
-   
-            // clip top of text to eliminate unused pixel rows
-            for (int i = 0; i < h; ++i) {
-               for (int j = 0; j < w; ++j) { 
-                  if (gdImageAlpha(im, gdImageGetPixel(tmp, j, i)) < 127) {
-                     t = i;
-                     goto TCLIP;
-                  }            
-               }
+            for (int r = 0; r < rows && down.size() <= 256; ++r) {
+               const double y = layout.y(p, r);
+               down.insert(phase_png(png->turned ? png->turn_x - y : y, q,
+                                     pixel));
             }
-            TCLIP:
-
-            // clip bottom of text to eliminate unused pixel rows 
-            for (int i = h-1; i >= 0; --i) {
-               for (int j = 0; j < w; ++j) { 
-                  if (gdImageAlpha(im, gdImageGetPixel(tmp, j, i)) < 127) {
-                     b = i;
-                     goto BCLIP;
-                  }            
-               }
-            }
-            BCLIP:
-
-            w = r-l+1;
-            h = b-t+1;
 
-            gdImageCopy(im, tmp, int(x-(w/2)+1+mleft),
-                                 int(y-(h/2)+1+mtop), l, t, w, h);
-            gdImageDestroy(tmp);
+            n += across.size()*down.size();
+            if (n > 256 && q > 16) break;
 
-            if (err) throw runtime_error(err);
+            for (set<int>::iterator i = across.begin(); i != across.end(); ++i)
+               for (set<int>::iterator j = down.begin(); j != down.end(); ++j)
+                  phases.insert(png->turned ? make_pair(*j, *i)
+                                            : make_pair(*i, *j));
          }
+
+         if (n > 256 && q > 16) phases.clear();
+         else marker.q = q;
       }
-   }   
-
-   if (grain == Horizontal) {
-      int sx = gdImageSX(im), sy = gdImageSY(im);
-      gdImagePtr rot = gdImageCreateTrueColor(sy, sx);
-         
-      // anti-alias to the alpha channel if our background is transparent
-      if (bg_opacity == 127) {
-         gdImageSaveAlpha(rot, 1);
-         gdImageAlphaBlending(rot, 0);
+
+      const int w = 2*marker.reach + 2;
+      for (set<pair<int, int> >::iterator i = phases.begin();
+           i != phases.end(); ++i) {
+         const double x = marker.reach + double(i->first)/marker.q,
+                      y = marker.reach + double(i->second)/marker.q;
+         Segment s[2] = {
+            { x-center_size, y, x+center_size, y },
+            { x, y-center_size, x, y+center_size }
+         };
+
+         marker.crosses[*i] =
+            Raster::sprite(w, w, vector<Segment>(s, s+2), grid_thickness,
+                           png->cc);
       }
+   }
+}
+
 
-      // rotate 90 degrees
-      for (int i = 0; i < sx; ++i)
-         for (int j = 0; j < sy; ++j)
-            gdImageSetPixel(rot, sy-1-j, i, gdImageGetPixel(im, i, j));
+void Grid::stamp_png()
+{
+   Stamp &stamp = png->stamp;
+
+   // Only where every side and center nearby belongs to the grid does the
+   // image match the repeating pattern: from the second column to the
+   // second last and the second row to the last, less room for the lines.
+   const double m = 2*grid_thickness + center_size + 2;
+   double sx1 = mleft + hw + m,
+          sy1 = mtop + hh + m,
+          sx2 = mleft + 0.75*(cols-1)*hw - m,
+          sy2 = mtop + rows*hh - m;
+   if (sx1 > sx2 || sy1 > sy2) return;
+
+   place_png(sx1, sy1);
+   place_png(sx2, sy2);
+   if (sx1 > sx2) swap(sx1, sx2);
+   if (sy1 > sy2) swap(sy1, sy2);
+
+   // the pattern repeats every two columns and every row
+   double lx = mleft, ly = mtop;
+   place_png(lx, ly);
+   const double px = png->turned ? hh : 1.5*hw,
+                py = png->turned ? 1.5*hw : hh;
+
+   // Antialiased tiles can stand in for those a fraction of a pixel away,
+   // but a jagged line must be drawn exactly where it falls.
+   const int q = antialiased ? 16 : 4096;
+
+   vector<int> xs, ys, xp, yp,
+               xr, yr;              // a tile column and row at each phase
+   map<int, int> xk, yk;            // phases, numbered as first seen
+
+   for (int a = int(floor((sx1 - lx)/px)); ; ++a) {
+      const int s = int(ceil(lx + a*px)),
+                e = int(ceil(lx + (a+1)*px));
+      if (s < sx1) continue;
+      if (e-1 > sx2) break;
+
+      const int k = int(round((s - (lx + a*px))*q));
+      if (xk.find(k) == xk.end()) {
+         const int n = xk.size();
+         xk[k] = n;
+         xr.push_back(s);
+      }
 
-      gdImageDestroy(im);
-      im = rot;
+      if (xs.empty()) xs.push_back(s);
+      xs.push_back(e);
+      xp.push_back(xk[k]);
    }
 
-   FILE *out;
-   if (outfile.empty() || outfile == "-") out = stdout;
-   else {
-      out = fopen(outfile.c_str(), "wb");
-      if (!out) throw runtime_error("cannot write to " + outfile);
+   for (int b = int(floor((sy1 - ly)/py)); ; ++b) {
+      const int s = int(ceil(ly + b*py)),
+                e = int(ceil(ly + (b+1)*py));
+      if (s < sy1) continue;
+      if (e-1 > sy2) break;
+
+      const int k = int(round((s - (ly + b*py))*q));
+      if (yk.find(k) == yk.end()) {
+         const int n = yk.size();
+         yk[k] = n;
+         yr.push_back(s);
+      }
+
+      if (ys.empty()) ys.push_back(s);
+      ys.push_back(e);
+      yp.push_back(yk[k]);
    }
-   
-   gdImagePngEx(im, out, 9);
-   if (out != stdout) fclose(out);
-   gdImageDestroy(im);
-}
 
+   // give up if there are too many phases for tiles to pay
+   if (xp.empty() || yp.empty() || xr.size()*yr.size() > 256) return;
 
-void Grid::side_png(int n)
-{
-   double dx = 0,
-          dy = 0;
+   // render a tile at each pair of phases, with a pixel to spare for
+   // tiles in the same phase which are a pixel wider or taller
+   const int tw = int(ceil(px)) + 1,
+             th = int(ceil(py)) + 1;
 
-   switch (n % 4) {
-   case 0:
-      dx = 0.25*hw;
-      dy = 0.5*hh;
-      break;
-   case 2:
-      dx = 0.25*hw;
-      dy = -0.5*hh;
-      break;
-   case 1:
-   case 3:
-      dx = 0.5*hw;
-      break;
+   stamp.tiles.clear();
+   for (size_t i = 0; i < xr.size(); ++i) {
+      for (size_t j = 0; j < yr.size(); ++j) {
+         shared_ptr<Raster> t(new Raster(tw, th, th, png->format));
+         tile_png(t.get(), xr[i], yr[j]);
+         stamp.tiles.push_back(t);
+      }
    }
 
-   line_png(int(round(cx)), int(round(cy)),
-            int(round(cx+dx)), int(round(cy+dy)), gc);
-
-   cx += dx;
-   cy += dy;
+   stamp.xs.swap(xs);
+   stamp.ys.swap(ys);
+   stamp.xp.swap(xp);
+   stamp.yp.swap(yp);
+   stamp.np = yr.size();
+   stamp.x1 = stamp.xs.front();
+   stamp.x2 = stamp.xs.back()-1;
+   stamp.y1 = stamp.ys.front();
+   stamp.y2 = stamp.ys.back()-1;
 }
 
 
-void Grid::side_reverse_png(int n)
+void Grid::tile_png(Raster *tile, int x, int y)
 {
-   double dx = 0,
-          dy = 0;
+   // draw the tile as if it were at x, y in the image
+   Raster *const image = im;
+   im = tile;
+   ox = x;
+   oy = y;
+   clipped = false;
 
-   switch (n % 4) {
-   case 0:
-      dx = -0.25*hw;
-      dy = 0.5*hh;
-      break;
-   case 2:
-      dx = -0.25*hw;
-      dy = -0.5*hh;
-      break;
-   case 1:
-   case 3:
-      dx = -0.5*hw;
-      break;
-   }
+   im->alpha_blending(bg_opacity != 127);
+   im->fill(0, 0, im->width()-1, im->height()-1, png->bc);
 
-   line_png(int(round(cx)), int(round(cy)),
-            int(round(cx+dx)), int(round(cy+dy)), gc);
+   hexes_png(false);
 
-   cx += dx;
-   cy += dy;
+   im = image;
+   ox = oy = 0;
 }
 
 
-void Grid::side_skip_png(int n)
+void Grid::near_png(double m, int &c1, int &c2, int &r1, int &r2)
 {
-   double dx = 0,
-          dy = 0;
-
-   switch (n % 4) {
-   case 0:
-      dx = 0.25*hw;
-      dy = 0.5*hh;
-      line_png(int(round(cx)), int(round(cy)),
-               int(round(cx+dx)), int(round(cy+dy)), gc);
-      break;
-   case 2:
-      dx = 0.25*hw;
-      dy = -0.5*hh;
-      line_png(int(round(cx)), int(round(cy)),
-               int(round(cx+dx)), int(round(cy+dy)), gc);
-      break;
-   case 1:
-   case 3:
-      dx = 0.5*hw;
-      break;
+   // the hexes within m of the rows of im being drawn
+   double vx1 = ox, vy1 = oy + im->first(),
+          vx2 = ox + im->width(), vy2 = oy + im->last() + 1;
+   if (png->turned) {
+      const double tx1 = vx1, tx2 = vx2;
+      vx1 = vy1;
+      vx2 = vy2;
+      vy1 = png->turn_x - tx2;
+      vy2 = png->turn_x - tx1;
    }
 
-   cx += dx;
-   cy += dy;
+   layout.near(vx1, vy1, vx2, vy2, m, c1, c2, r1, r2);
 }
 
 
-void Grid::edge_png(int n)
+void Grid::hexes_png(bool whole)
 {
-   double dx = (n % 2 ? 0.25 : -0.25)*hw,
-          dy = 0.5*hh;
+   int c1, c2, r1, r2;
+   near_png(2*grid_thickness + center_size + 2, c1, c2, r1, r2);
+   layout.build(c1, c2, r1, r2, whole, mesh);
 
-   line_png(int(round(cx)), int(round(cy)),
-            int(round(cx+dx)), int(round(cy+dy)), gc);
-   cx += dx;
-   cy += dy;            
-}
+   for (size_t k = 0; k < mesh.e1.size(); ++k) {
+      const unsigned int a = mesh.e1[k], b = mesh.e2[k];
+      line_png(mesh.vx[a], mesh.vy[a], mesh.vx[b], mesh.vy[b], png->gc);
+   }
 
+   im->stroke(segs, grid_thickness, png->gc);
+   segs.clear();
 
-void Grid::edge_reverse_png(int n)
-{
-   double dx = (n % 2 ? 0.25 : -0.25)*hw,
-          dy = -0.5*hh;
-
-   line_png(int(round(cx)), int(round(cy)),
-            int(round(cx+dx)), int(round(cy+dy)), gc);
-   cx += dx;
-   cy += dy;     
+   switch (center_style) {
+   case Cross:
+      for (size_t k = 0; k < mesh.cx.size(); ++k)
+         cross_png(mesh.cx[k], mesh.cy[k]);
+      im->stroke(segs, grid_thickness, png->cc);
+      segs.clear();
+      break;
+   case Dot:
+      for (size_t k = 0; k < mesh.cx.size(); ++k)
+         dot_png(mesh.cx[k], mesh.cy[k]);
+      break;
+   default:
+      break;
+   }
 }
 
 
-void Grid::cross_png(int c, int r)
+void Grid::coord_png(int col, int row)
 {
-   line_png(int(round((c*0.75 + 0.5)*hw-center_size+mleft)),
-            int(round((0.5*(1+(c+lowfirstcol)%2)+r)*hh+mtop)),
-            int(round((c*0.75 + 0.5)*hw+center_size+mleft)),
-            int(round((0.5*(1+(c+lowfirstcol)%2)+r)*hh+mtop)), cc);
-   line_png(int(round((c*0.75 + 0.5)*hw+mleft)),
-            int(round((0.5*(1+(c+lowfirstcol)%2)+r)*hh-center_size+mtop)),
-            int(round((c*0.75 + 0.5)*hw+mleft)),
-            int(round((0.5*(1+(c+lowfirstcol)%2)+r)*hh+center_size+mtop)), cc);
+   double lx = layout.x(col) + coord_dist*cos(coord_bearing*rad),
+          ly = layout.y(col, row) + coord_dist*sin(coord_bearing*rad);
+
+   labels.format(col+view_col, row+view_row, label_text);
+   png->font->layout(label_text, label);
+
+   const int w = label.r-label.l+1,
+             h = label.b-label.t+1;
+
+   place_png(lx, ly);
+
+   // composite the glyphs so that the inked box is centered on the label
+   const int ox = int(floor(lx-(w/2)+1)) - label.l,
+             oy = int(floor(ly-(h/2)+1)) - label.t;
+   for (size_t k = 0; k < label.pieces.size(); ++k) {
+      const Text::Piece &p = label.pieces[k];
+      const Glyph &g = *p.glyph;
+      if (g.mask.empty()) continue;
+      im->mask(ox+p.x+g.x, oy+p.y+g.y, g.width, g.height, &g.mask[0],
+               png->tc);
+   }
 }
 
 
-void Grid::dot_png(int c, int r)
+void Grid::cross_png(double cx, double cy)
 {
-   cx = (c*0.75 + 0.5)*hw+mleft;
-   cy = (0.5*(1+(c+lowfirstcol)%2)+r)*hh+mtop;
-
-   if (antialiased) {
-      double o2 = (center_size+1)*(center_size+1),
-             i2 = center_size*center_size;
-
-      for (double x = -center_size; x <= center_size; ++x) {
-         for (double y = -center_size; y <= center_size; ++y) {
-            double x2y2 = x*x + y*y;
-            if (x2y2 < i2) {        // interior pixel
-               pixel_png(int(round(cx+x)), int(round(cy+y)), cc);
-            }
-            else if (x2y2 < o2) {   // edge pixel
-               double d = sqrt(x2y2)-center_size;
-               int b = gdImageColorExactAlpha(im, gdImageRed(im, cc),
-                                                  gdImageGreen(im, cc),
-                                                  gdImageBlue(im, cc),
-                                                  (unsigned int)round(d*127));
-               pixel_png(int(round(cx+x)), int(round(cy+y)), b);
-            }
-         }
+   const Markers &marker = png->marker;
+
+   double x = cx, y = cy;
+   place_png(x, y);
+   if (stamped_png(x, y, x, y, center_size + grid_thickness + 2)) return;
+
+   if (marker.q) {
+      int px, py;
+      const pair<int, int> k(phase_png(x, marker.q, px),
+                             phase_png(y, marker.q, py));
+      map<pair<int, int>, Sprite>::const_iterator i = marker.crosses.find(k);
+      if (i != marker.crosses.end()) {
+         im->paint(px - marker.reach, py - marker.reach, i->second, png->cc);
+         return;
       }
    }
-   else gdImageFilledEllipse(im, int(round(cx)), int(round(cy)),
-                                 int(round(center_size)),
-                                 int(round(center_size)), cc);
+
+   line_png(cx-center_size, cy, cx+center_size, cy, png->cc);
+   line_png(cx, cy-center_size, cx, cy+center_size, png->cc);
 }
 
 
-void Grid::line_png(int x1, int y1, int x2, int y2, int c)
+void Grid::dot_png(double cx, double cy)
 {
+   place_png(cx, cy);
+   if (stamped_png(cx, cy, cx, cy, center_size + 2)) return;
+
    if (antialiased) {
-      // adapted from gdImageSetAALine() in gd-2.0.33
-
-   	/* keep them as 32bits */
-   	long x, y, inc;
-   	long dx, dy,tmp;
-
-     	dx = x2 - x1;
-   	dy = y2 - y1;
-
-   	if (dx == 0 && dy == 0) {
-   		/* TBB: allow setting points */
-   		pixel_png(x1, y1, c);
-   		return;
-   	}
-
-   	if (abs(dx) > abs(dy)) {
-   		if (dx < 0) {
-   			tmp = x1;
-   			x1 = x2;
-   			x2 = tmp;
-   			tmp = y1;
-   			y1 = y2;
-   			y2 = tmp;
-   			dx = x2 - x1;
-   			dy = y2 - y1;
-   		}
-   		x = x1 << 16;
-   		y = y1 << 16;
-   		inc = (dy * 65536) / dx;
-   		/* TBB: set the last pixel for consistency (<=) */
-   		while ((x >> 16) <= x2) {
-            int a = gdImageColorExactAlpha(im, gdImageRed(im, c),
-                                               gdImageGreen(im, c),
-                                               gdImageBlue(im, c),
-                                               ((y >> 8) & 0xFF)/2);
-            int b = gdImageColorExactAlpha(im, gdImageRed(im, c),
-                                               gdImageGreen(im, c),
-                                               gdImageBlue(im, c),
-                                               ((~y >> 8) & 0xFF)/2);
-	   		pixel_png(x >> 16, y >> 16, a);
-   			pixel_png(x >> 16, (y >> 16) + 1, b);
-   			x += (1 << 16);
-   			y += inc;
-   		}
-   	} 
-      else {
-   		if (dy < 0) {
-   			tmp = x1;
-   			x1 = x2;
-   			x2 = tmp;
-   			tmp = y1;
-   			y1 = y2;
-   			y2 = tmp;
-   			dx = x2 - x1;
-   			dy = y2 - y1;
-   		}
-   		x = x1 << 16;
-   		y = y1 << 16;
-   		inc = (dx * 65536) / dy;
-   		/* TBB: set the last pixel for consistency (<=) */
-   		while ((y >> 16) <= y2) {
-            int a = gdImageColorExactAlpha(im, gdImageRed(im, c),
-                                               gdImageGreen(im, c),
-                                               gdImageBlue(im, c),
-                                               ((x >> 8) & 0xFF)/2);
-            int b = gdImageColorExactAlpha(im, gdImageRed(im, c),
-                                               gdImageGreen(im, c),
-                                               gdImageBlue(im, c),
-                                               ((~x >> 8) & 0xFF)/2);
-   			pixel_png(x >> 16, y >> 16, a);
-   			pixel_png((x >> 16) + 1, (y >> 16), b);
-   			x += inc;
-   			y += (1<<16);
-   		}
-   	}
+      im->paint(pixel_png(cx-center_size), pixel_png(cy-center_size),
+                png->marker.dot, png->cc);
    }
-   else gdImageLine(im, x1, y1, x2, y2, c);
+   else im->ellipse(pixel_png(cx), pixel_png(cy),
+                    int(round(center_size)),
+                    int(round(center_size)), png->cc);
 }
 
 
-void Grid::pixel_png(int x, int y, int c)
+void Grid::line_png(double x1, double y1, double x2, double y2,
+                    const Ramp &c)
 {
-   if (bg_opacity == 127) {
-      if (gdImageAlpha(im, gdImageGetPixel(im, x, y)) > gdImageAlpha(im, c)) {
-         gdImageAlphaBlending(im, 0);
-      	gdImageSetPixel(im, x, y, c);     
-         gdImageAlphaBlending(im, 1);
-      }
+   place_png(x1, y1);
+   place_png(x2, y2);
+   if (stamped_png(x1, y1, x2, y2, grid_thickness + 2)) return;
+
+   // antialiased segments are queued, and stroked together by the caller
+   if (antialiased) {
+      Segment seg = { x1, y1, x2, y2 };
+      segs.push_back(seg);
    }
-   else gdImageSetPixel(im, x, y, c);
+   else im->line(pixel_png(x1), pixel_png(y1),
+                 pixel_png(x2), pixel_png(y2), int(grid_thickness), c);
 }
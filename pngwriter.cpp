@@ -0,0 +1,417 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <zlib.h>
+
+#include "pngwriter.h"
+#include "raster.h"
+
+// deflate looks back at most this far
+static const size_t window = 32768;
+
+// the length of every IDAT chunk but the last, and of the blocks of
+// filtered rows handed to zlib by one thread, so that how the rows are
+// split into strips does not show in the file
+static const size_t idat_length = 65536;
+static const size_t block = 65536;
+
+static void put32(unsigned char *p, unsigned long v)
+{
+   p[0] = (v >> 24) & 0xff;
+   p[1] = (v >> 16) & 0xff;
+   p[2] = (v >>  8) & 0xff;
+   p[3] =  v        & 0xff;
+}
+
+
+static void filter_row(int type, const unsigned char *cur,
+                       const unsigned char *up, int n, int bpp,
+                       unsigned char *dst)
+{
+   dst[0] = type;
+   ++dst;
+
+   switch (type) {
+   case PngWriter::None:
+      copy(cur, cur + n, dst);
+      break;
+   case PngWriter::Sub:
+      for (int i = 0; i < n; ++i)
+         dst[i] = cur[i] - (i >= bpp ? cur[i-bpp] : 0);
+      break;
+   case PngWriter::Up:
+      for (int i = 0; i < n; ++i)
+         dst[i] = cur[i] - up[i];
+      break;
+   case PngWriter::Average:
+      for (int i = 0; i < n; ++i)
+         dst[i] = cur[i] - ((i >= bpp ? cur[i-bpp] : 0) + up[i])/2;
+      break;
+   case PngWriter::Paeth:
+      for (int i = 0; i < n; ++i) {
+         const int a = i >= bpp ? cur[i-bpp] : 0,
+                   b = up[i],
+                   c = i >= bpp ? up[i-bpp] : 0,
+                   pa = abs(b - c),
+                   pb = abs(a - c),
+                   pc = abs(a + b - 2*c);
+         dst[i] = cur[i] - (pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+      }
+      break;
+   }
+}
+
+
+PngWriter::PngWriter(ostream &out, int w, int h, Raster::Format format,
+                     bool alpha, const vector<unsigned char> &palette,
+                     int level, Filter filter, unsigned int threads)
+ : out(out), w(w), h(h), format(format), alpha(alpha), level(level),
+   filter(filter), threads(max(threads, 1u)), y(0),
+   dict(0), adler(adler32(0, NULL, 0)), zs(0)
+{
+   static const unsigned char sig[8] = {
+      0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+   };
+
+   if (!out.write((const char *) sig, 8))
+      throw runtime_error("error writing PNG");
+
+   // bit depth and color type
+   int depth = 8, type = 0;
+   switch (format) {
+   case Raster::RGBA:      type = alpha ? 6 : 2; break;
+   case Raster::GrayAlpha: type = 4;             break;
+   case Raster::Gray:      type = 0;             break;
+   case Raster::Bilevel:   type = 0; depth = 1;  break;
+   case Raster::Indexed:
+      // pack small palettes' entries several to a byte
+      type = 3;
+      while (depth > 1 && palette.size()/4 <= (1u << (depth/2))) depth /= 2;
+      break;
+   }
+
+   bits = depth*(type == 6 ? 4 : type == 2 ? 3 : type == 4 ? 2 : 1);
+   bpp = max(bits/8, 1);
+   n = (size_t(w)*bits + 7)/8;
+   prev.resize(n);
+
+   unsigned char ihdr[13];
+   put32(ihdr, w);
+   put32(ihdr+4, h);
+   ihdr[8] = depth;
+   ihdr[9] = type;
+   ihdr[10] = ihdr[11] = ihdr[12] = 0;
+   chunk("IHDR", ihdr, 13);
+
+   if (format == Raster::Indexed) {
+      vector<unsigned char> plte, trns;
+      for (size_t i = 0; i < palette.size(); i += 4) {
+         plte.insert(plte.end(), &palette[i], &palette[i] + 3);
+         trns.push_back(palette[i+3]);
+      }
+
+      // entries missing from the end of tRNS are opaque
+      while (!trns.empty() && trns.back() == 255) trns.pop_back();
+
+      chunk("PLTE", &plte[0], plte.size());
+      if (!trns.empty()) chunk("tRNS", &trns[0], trns.size());
+   }
+
+   if (this->threads == 1) {
+      z_stream *z = new z_stream;
+      z->zalloc = Z_NULL;
+      z->zfree = Z_NULL;
+      z->opaque = Z_NULL;
+      if (deflateInit(z, level) != Z_OK) {
+         delete z;
+         throw runtime_error("cannot initialize zlib");
+      }
+      zs = z;
+   }
+   else {
+      // the zlib header for the pieces, which are raw deflate data
+      unsigned char zh[2] = { 0x78, 0 };
+      zh[1] = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+      zh[1] += 31 - (zh[0]*256 + zh[1]) % 31;
+      idat(zh, 2);
+   }
+}
+
+
+PngWriter::~PngWriter()
+{
+   if (zs) {
+      deflateEnd((z_stream *) zs);
+      delete (z_stream *) zs;
+   }
+}
+
+
+void PngWriter::pack(const unsigned char *src, unsigned char *dst) const
+{
+   if (format == Raster::RGBA && !alpha) {
+      // drop the filler byte of each pixel
+      for (int x = 0; x < w; ++x, src += 4, dst += 3) {
+         dst[0] = src[0];
+         dst[1] = src[1];
+         dst[2] = src[2];
+      }
+   }
+   else if (format == Raster::Indexed && bits < 8) {
+      fill(dst, dst + n, 0);
+      const int per = 8/bits;
+      for (int x = 0; x < w; ++x)
+         dst[x/per] |= src[x] << (8 - bits*(x % per + 1));
+   }
+   else copy(src, src + n, dst);
+}
+
+
+void PngWriter::filter_rows(const Raster &r, int y1, int y2,
+                            unsigned char *dst)
+{
+   vector<unsigned char> cur(n), up(n), best;
+   if (filter == Adaptive) best.resize(n+1);
+
+   if (y1 == r.first()) up = prev;
+   else pack(r.row(y1-1), &up[0]);
+
+   for (int y = y1; y <= y2; ++y, dst += n+1) {
+      pack(r.row(y), &cur[0]);
+
+      if (filter != Adaptive) filter_row(filter, &cur[0], &up[0], n, bpp, dst);
+      else {
+         // pick the filter giving the smallest sum of absolute
+         // differences, as libpng does
+         unsigned long least = ~0ul;
+         for (int t = None; t <= Paeth; ++t) {
+            filter_row(t, &cur[0], &up[0], n, bpp, &best[0]);
+
+            unsigned long sum = 0;
+            for (size_t i = 1; i <= n && sum < least; ++i)
+               sum += best[i] < 128 ? best[i] : 256 - best[i];
+
+            if (sum < least) {
+               least = sum;
+               copy(best.begin(), best.end(), dst);
+            }
+         }
+      }
+
+      cur.swap(up);
+   }
+}
+
+
+void PngWriter::deflate_piece(size_t begin, size_t end, bool last,
+                              vector<unsigned char> *zd, unsigned long *sum,
+                              exception_ptr *err)
+{
+   try {
+      z_stream z;
+      z.zalloc = Z_NULL;
+      z.zfree = Z_NULL;
+      z.opaque = Z_NULL;
+      if (deflateInit2(&z, level, Z_DEFLATED, -15, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK)
+         throw runtime_error("cannot initialize zlib");
+
+      // prime the piece with the data before it
+      const size_t d = begin - min(begin, window);
+      if (begin > d) deflateSetDictionary(&z, &data[d], begin - d);
+
+      zd->resize(deflateBound(&z, end - begin) + 16);
+      z.next_in = &data[0] + begin;
+      z.avail_in = end - begin;
+      z.next_out = &(*zd)[0];
+      z.avail_out = zd->size();
+
+      // a sync flush leaves the piece ending on a byte boundary
+      const int ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+      zd->resize(zd->size() - z.avail_out);
+      deflateEnd(&z);
+
+      if (ret != (last ? Z_STREAM_END : Z_OK) || z.avail_in)
+         throw runtime_error("error compressing PNG");
+
+      *sum = adler32(adler32(0, NULL, 0), &data[0] + begin, end - begin);
+   }
+   catch (...) {
+      *err = current_exception();
+   }
+}
+
+
+void PngWriter::write(const Raster &r)
+{
+   if (r.first() != y || r.last() >= h || r.format() != format)
+      throw runtime_error("PNG rows written out of order");
+
+   const int rows = r.last() - r.first() + 1;
+   if (rows <= 0) return;
+
+   const size_t stride = n + 1;
+   const bool last = r.last() == h-1;
+
+   data.resize(dict + rows*stride);
+
+   if (threads == 1) {
+      filter_rows(r, r.first(), r.last(), &data[dict]);
+
+      // hand zlib whole blocks, one at a time, and hold back what does
+      // not fill a block until the next strip
+      z_stream *z = (z_stream *) zs;
+      vector<unsigned char> zd(65536);
+      size_t len = 0;
+
+      while (data.size() - len >= block || (last && len < data.size())) {
+         const size_t k = min(block, data.size() - len);
+         const bool end = last && len + k == data.size();
+
+         z->next_in = &data[len];
+         z->avail_in = k;
+         len += k;
+
+         int ret;
+         do {
+            z->next_out = &zd[0];
+            z->avail_out = zd.size();
+            ret = deflate(z, end ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR)
+               throw runtime_error("error compressing PNG");
+            idat(&zd[0], zd.size() - z->avail_out);
+         } while (z->avail_out == 0 || (end && ret != Z_STREAM_END));
+      }
+
+      data.erase(data.begin(), data.begin() + len);
+      dict = data.size();
+   }
+   else {
+      // split the strip into pieces of whole rows, one per thread
+      vector<int> bounds;
+      for (unsigned int k = 0; k < threads; ++k) {
+         const int b = r.first() + int((long long)rows*k/threads);
+         if (bounds.empty() || b > bounds.back()) bounds.push_back(b);
+      }
+      bounds.push_back(r.last()+1);
+
+      const size_t n = bounds.size()-1;
+      vector<thread> workers;
+
+      for (size_t k = 0; k < n; ++k) {
+         workers.push_back(thread(&PngWriter::filter_rows, this, cref(r),
+                                  bounds[k], bounds[k+1]-1,
+                                  &data[dict + (bounds[k]-y)*stride]));
+      }
+      for (size_t k = 0; k < n; ++k) workers[k].join();
+      workers.clear();
+
+      vector<vector<unsigned char> > zd(n);
+      vector<unsigned long> sums(n);
+      vector<exception_ptr> errs(n);
+
+      for (size_t k = 0; k < n; ++k) {
+         workers.push_back(thread(&PngWriter::deflate_piece, this,
+                                  dict + (bounds[k]-y)*stride,
+                                  dict + (bounds[k+1]-y)*stride,
+                                  last && k == n-1,
+                                  &zd[k], &sums[k], &errs[k]));
+      }
+      for (size_t k = 0; k < n; ++k) workers[k].join();
+
+      for (size_t k = 0; k < n; ++k)
+         if (errs[k]) rethrow_exception(errs[k]);
+
+      for (size_t k = 0; k < n; ++k) {
+         adler = adler32_combine(adler, sums[k],
+                                 (bounds[k+1]-bounds[k])*stride);
+
+         if (last && k == n-1) {
+            // the checksum of the whole stream ends it
+            zd[k].resize(zd[k].size() + 4);
+            put32(&zd[k][zd[k].size()-4], adler);
+         }
+
+         idat(&zd[k][0], zd[k].size());
+      }
+
+      // keep the end of the strip for priming the next one
+      if (data.size() > window) {
+         data.erase(data.begin(), data.end() - window);
+      }
+      dict = data.size();
+   }
+
+   pack(r.row(r.last()), &prev[0]);
+   y = r.last()+1;
+}
+
+
+void PngWriter::finish()
+{
+   if (y != h) throw runtime_error("PNG is missing rows");
+
+   if (!zbuf.empty()) chunk("IDAT", &zbuf[0], zbuf.size());
+   chunk("IEND", NULL, 0);
+   if (!out.flush()) throw runtime_error("error writing PNG");
+}
+
+
+void PngWriter::idat(const unsigned char *buf, size_t len)
+{
+   while (len) {
+      const size_t k = min(len, idat_length - zbuf.size());
+      zbuf.insert(zbuf.end(), buf, buf + k);
+      buf += k;
+      len -= k;
+
+      if (zbuf.size() == idat_length) {
+         chunk("IDAT", &zbuf[0], zbuf.size());
+         zbuf.clear();
+      }
+   }
+}
+
+
+void PngWriter::chunk(const char *type, const unsigned char *buf,
+                      size_t len)
+{
+   unsigned char head[8], tail[4];
+   put32(head, len);
+   copy(type, type+4, head+4);
+
+   unsigned long crc = crc32(0, head+4, 4);
+   if (len) crc = crc32(crc, buf, len);
+   put32(tail, crc);
+
+   out.write((const char *) head, 8);
+   if (len) out.write((const char *) buf, len);
+   if (!out.write((const char *) tail, 4))
+      throw runtime_error("error writing PNG");
+}
@@ -0,0 +1,96 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __PNGWRITER_H_
+#define __PNGWRITER_H_
+
+#include <exception>
+#include <ostream>
+#include <vector>
+using namespace std;
+
+#include "raster.h"
+
+//
+// Writes a PNG as its rows are drawn, so the whole image need never be
+// held at once. The PNG has the color type of the raster's format. RGBA
+// rasters without an alpha channel have the fourth byte of each pixel
+// dropped, and indexed rasters are written with as few bits for each
+// entry as their palette allows.
+//
+// With more than one thread, each strip of rows is filtered and deflated
+// in pieces concurrently, as pigz does. Every piece is primed with the
+// data before it and ends on a byte boundary, so the pieces join into a
+// single zlib stream.
+//
+// The stream is cut into IDAT chunks of a fixed length, so the file
+// depends on how the rows are split into strips only through those
+// pieces.
+//
+class PngWriter {
+   public:
+      // filter types, as numbered in PNG, and choosing one for each row
+      enum Filter { None, Sub, Up, Average, Paeth, Adaptive };
+
+      // the palette, as RGBA, is for indexed rasters
+      PngWriter(ostream &out, int w, int h, Raster::Format format, bool alpha,
+                const vector<unsigned char> &palette, int level,
+                Filter filter, unsigned int threads);
+      ~PngWriter();
+
+      // write the rows held by the raster, which must follow on from
+      // those written before
+      void write(const Raster &r);
+      void finish();
+
+   private:
+      PngWriter(const PngWriter &);
+      PngWriter &operator=(const PngWriter &);
+
+      void pack(const unsigned char *src, unsigned char *dst) const;
+      void filter_rows(const Raster &r, int y1, int y2, unsigned char *dst);
+      void deflate_piece(size_t begin, size_t end, bool last,
+                         vector<unsigned char> *z, unsigned long *sum,
+                         exception_ptr *err);
+      void idat(const unsigned char *buf, size_t len);
+      void chunk(const char *type, const unsigned char *buf, size_t len);
+
+      ostream &out;
+      int w, h;
+      Raster::Format format;
+      bool alpha;
+      int bits, bpp;                // bits per pixel, and bytes, at least 1
+      size_t n;                     // bytes per row
+      int level;
+      Filter filter;
+      unsigned int threads;
+
+      int y;                        // rows written so far
+      vector<unsigned char> prev;   // the last row written, unfiltered
+      vector<unsigned char> data;   // filtered rows, with what precedes
+                                    // them kept as a deflate dictionary
+      size_t dict;                  // length of that dictionary, or
+                                    // with one thread of the rows not
+                                    // yet handed to zlib
+      unsigned long adler;          // checksum of all filtered rows
+      vector<unsigned char> zbuf;   // compressed data short of a chunk
+      void *zs;                     // z_stream, kept out of this header
+};
+
+#endif /* __PNGWRITER_H_ */
@@ -20,25 +20,43 @@
 #include <cmath>
 #include <iostream>
 #include <iomanip>
-#include <fstream>
 #include <string>
 #include <sstream>
 #include <exception>
 #include <stdexcept>
+#include <vector>
 using namespace std;
 
 #include "grid.h"
+#include "textwriter.h"
 
-void Grid::draw_ps()
+// Writes the path along the given sides of m, a few points to a line.
+static void sides_ps(TextWriter &out, const HexMesh &m,
+                     const vector<unsigned int> &sides, const char *indent)
 {
-   ofstream out;
-   if (outfile.empty() || outfile == "-") out.ostream::rdbuf(cout.rdbuf());
-   else {
-      filebuf *buf = new filebuf;
-      buf->open(outfile.c_str(), ios::out | ios::binary);
-      out.ostream::rdbuf(buf);
-      if (!out) throw runtime_error("cannot write to " + outfile);
+   vector<vector<unsigned int> > runs;
+   m.chain(sides, runs);
+
+   for (size_t i = 0; i < runs.size(); ++i) {
+      const vector<unsigned int> &run = runs[i];
+      const bool closed = run.size() > 3 && run.front() == run.back();
+      const size_t n = closed ? run.size() - 1 : run.size();
+
+      out << indent << m.vx[run[0]] << ' ' << m.vy[run[0]] << " moveto";
+      for (size_t j = 1; j < n; ++j) {
+         if (j % 4 == 0) out << '\n' << indent;
+         else out << ' ';
+         out << m.vx[run[j]] << ' ' << m.vy[run[j]] << " lineto";
+      }
+      if (closed) out << " closepath";
+      out << '\n';
    }
+}
+
+
+void Grid::draw_ps(ostream &os)
+{
+   TextWriter out(os, precision);
   
    // header
    out <<
@@ -71,9 +89,8 @@ void Grid::draw_ps()
 "/bg_color {" << bg_color << "} def\n";
 
    out <<
-"/hex_side   " << hs << " def\n"
-"/hex_height { 2 hex_side mul 60 sin mul} bind def\n"
-"/hex_width  { 2 hex_side mul } bind def\n"
+"/hex_width  " << hw << " def\n"
+"/hex_height " << hh << " def\n"
 "/hex_color  {"   << grid_color << "} def\n"
 "/hex_linewidth " << grid_thickness << " def\n"
 "\n"
@@ -101,88 +118,36 @@ void Grid::draw_ps()
 "/coord_tilt " << coord_tilt << " def\n"
 "\n";
 
+   // The grid's sides come from a mesh of the whole grid, laid out as
+   // SVG lays it out, downwards, and turned over when drawn. The upper
+   // left, top and lower left sides of the top row are the same in every
+   // row, so they are one procedure, and the sides which no row has that
+   // way close the grid. With horizontal grain, the grid is drawn with
+   // vertical grain and turned, so its columns are the rows.
+   const int gcols = grain == Horizontal ? rows : cols,
+             grows = grain == Horizontal ? cols : rows;
+
+   HexLayout layout(hw, hh, 0, 0, gcols, grows, lowfirstcol);
+   HexMesh mesh;
+   layout.build(0, gcols-1, 0, grows-1, true, mesh);
+
+   vector<unsigned int> row, closing;
+   for (size_t k = 0; k < mesh.id.size(); ++k) {
+      int c, r, s;
+      layout.side_of(mesh.id[k], c, r, s);
+      if (s >= 2 && s <= 4) closing.push_back(k);
+      else if (r == 0) row.push_back(k);
+   }
+
    // definitions
    out <<
 "%\n"
 "% Definitions\n"
 "%\n"
-"/line {hex_side 0 rlineto} def\n"
-"/no_line {hex_side 0 rmoveto} def\n"
-"\n"
-"%\n"
-"%             1\n"
-"%          ________\n"
-"%         /        \\  \n"
-"%     0  /          \\ 2\n"
-"%       /            \\________\n"
-"%                        3\n"
-"%\n"
-"\n"
-"/side\n"
-"{\n"
-"   dup 0 eq {\n"
-"      % 0\n"
-"      60 rotate\n"
-"      line\n"
-"      -60 rotate \n"
-"   } {\n"
-"      dup 1 eq {\n"
-"         % 1\n"
-"         line\n"
-"      } {\n"
-"         dup 2 eq {\n"
-"            % 2\n"
-"            -60 rotate\n"
-"            line\n"
-"            60 rotate\n"
-"         } {\n"
-"            % 3\n"
-"            line\n"
-"         } ifelse\n"
-"      } ifelse\n"
-"   } ifelse \n"
-"\n"
-"   pop\n"
-"} bind def\n"
-"\n"
-"/side_skip\n"
-"{\n"
-"   dup 0 eq {\n"
-"      % 0\n"
-"      60 rotate\n"
-"      line\n"
-"      -60 rotate\n"
-"   } {\n"
-"      dup 1 eq {\n"
-"         % 1\n"
-"         no_line\n"
-"      } {\n"
-"         dup 2 eq {\n"
-"            % 2\n"
-"            -60 rotate\n"
-"            line\n"
-"            60 rotate\n"
-"         } {\n"
-"            % 3\n"
-"            no_line\n"
-"         } ifelse\n"
-"      } ifelse\n"
-"   } ifelse \n"
-"\n"
-"   pop\n"
-"} bind def\n"
-"\n"
-"/edge\n"
-"{\n"
-"   0 eq {\n"
-"      % 0\n"
-"      -60 rotate\n"
-"      line\n"
-"   } {\n"
-"      % 1\n"
-"      60 rotate\n"
-"      line\n"
-"   } ifelse\n"
+"/hex_row\n"
+"{\n";
+   sides_ps(out, mesh, row, "   ");
+   out <<
 "} bind def\n"
 "\n"
 "%%EndProlog\n"
@@ -226,73 +191,18 @@ void Grid::draw_ps()
 "hex_color setrgbcolor\n"
 "hex_linewidth setlinewidth\n"
 "\n"
-"mleft mbottom moveto\n"
-"\n"
-"lowfirstcol 0 eq {\n"
-"   60 rotate\n"
-"   no_line\n"
-"   -60 rotate\n"
-"\n"
-"   1 1 2 cols mul cols 2 mod sub { 4 mod side } for\n"
-"\n"
-"   1 cols 2 mod add 60 mul rotate\n"
-"   1 cols 2 mod sub 1 2 rows mul 1 sub cols 2 mod sub { 2 mod edge } for\n"
-"\n"
-"   1 cols 2 mod add 60 mul rotate\n"
-"   cols 2 mod 1 add 1 2 cols mul 2 cols 2 mod mul add { 4 mod side } for\n"
-"\n"
-"   60 rotate \n"
-"   1 1 2 rows mul 1 sub { 2 mod edge } for\n"
-"   closepath\n"
-"\n"
-"   60 rotate\n"
-"   rows 1 sub {\n"
-"      currentpoint\n"
-"\n"
-"      3 1 2 cols mul 1 add { 4 mod side_skip } for\n"
-"      moveto\n"
-"\n"
-"      0 hex_height rmoveto\n"
-"      currentpoint\n"
-"\n"
-"      1 1 2 cols mul 1 sub { 4 mod side } for\n"
-"      moveto\n"
-"   } repeat\n"
-"\n"
-"   3 1 2 cols mul 1 add { 4 mod side_skip } for\n"
-"} {\n"
-"   0 0.5 hex_height mul rmoveto\n"
-"\n"
-"   2 1 2 cols mul 2 add cols 1 add 2 mod sub { 4 mod side } for\n"
-"\n"
-"   1 cols 1 add 2 mod add 60 mul rotate\n"
-"   cols 2 mod 1 2 rows mul 1 sub cols 1 add 2 mod sub { 2 mod edge } for\n"
+"gsave\n"
+"mleft mbottom " << (grows+0.5)*hh << " add translate\n"
+"1 -1 scale\n"
 "\n"
-"   1 cols 1 add 2 mod add 60 mul rotate\n"
-"   2 cols 2 mod sub 1 2 cols mul 1 add 2 cols 2 mod mul sub { 4 mod side } for\n"
-"\n"
-"   120 rotate\n"
-"   0 1 2 rows mul 2 sub { 2 mod edge } for\n"
-"   closepath\n"
-"\n"
-"   120 rotate\n"
-"   0.25 hex_width mul 0.5 hex_height mul rmoveto\n"
-"   rows 1 sub {\n"
-"      currentpoint\n"
-"      currentpoint\n"
-"      1 1 2 cols mul 2 sub { 4 mod side_skip } for\n"
-"      moveto\n"
-"\n"
-"      3 1 2 cols mul 1 add { 4 mod side } for\n"
-"      moveto\n"
-"\n"
-"      0 hex_height rmoveto\n"
-"   } repeat\n"
-"\n"
-"   1 1 2 cols mul 2 sub { 4 mod side_skip } for\n"
-"} ifelse\n"
+<< grows << " { hex_row 0 hex_height translate } repeat\n"
+"0 " << -grows*hh << " translate\n"
+"\n";
+   sides_ps(out, mesh, closing, "");
+   out <<
 "\n"
 "stroke\n"
+"grestore\n"
 "\n";
 
    // print the centers
@@ -363,86 +273,72 @@ void Grid::draw_ps()
 "coord_font findfont\n"
 "coord_size scalefont\n"
 "setfont\n"
-"\n"
-"/coord_text [\n";
+"\n";
 
       if (grain == Horizontal) swap(rows, cols);
    
-      for (int c = 0; c < cols; ++c) {
-         for (int r = 0; r < rows; ++r) {
-            if ((c+coord_cstart) % coord_cskip || 
-                (r+coord_rstart) % coord_rskip) {
-               out << "() ";
-               continue;
-            }
+      // rows are counted up from the bottom of the whole map
+      const int rb = map_rows-view_row-rows;
 
-            int cc = 0, cr = 0;
-   
-            switch (coord_origin) {
-            case UpperLeft:
-               cc = c+coord_cstart;
-               cr = rows-r-1+coord_rstart;
-               break;
-            case UpperRight:
-               cc = cols-c-1+coord_cstart;
-               cr = rows-r-1+coord_rstart;
-               break;
-            case LowerLeft:
-               cc = c+coord_cstart;
-               cr = r+coord_rstart;
-               break;
-            case LowerRight:
-               cc = cols-c-1+coord_cstart;
-               cr = r+coord_rstart;
-               break;
-            }
+      // only every coord_rskip-th row and coord_cskip-th column is labelled
+      const int rs = skip_to(rb+coord_rstart, coord_rskip);
 
-            int a = cc, b = cr;
-            if (coord_order == RowsFirst) swap(a, b);
+      if (ps_label_proc) {
+         //
+         // The labels are made by the interpreter as each is shown, by a
+         // procedure doing what the label format does, so the file is the
+         // same size however many hexes are labelled. Hexes left
+         // unlabelled are stepped over by the loops.
+         //
+         const int cs = skip_to(view_col+coord_cstart, coord_cskip);
 
-            ostringstream s;
-            s << coord_fmt_pre;
+         out << labels.postscript("coord_label") <<
+"\n"
+<< cs << " coord_cskip cols 1 sub {\n"
+"   /coord_c exch def\n"
+"   " << rs << " coord_rskip rows 1 sub {\n"
+"      /coord_r exch def\n"
+"\n"
+"      mleft hex_width 2 div add coord_c 0.75 hex_width mul mul add\n"
+"      coord_c lowfirstcol add 1 add 2 mod 1 add 0.5 hex_height mul mul\n"
+"      coord_r hex_height mul add mbottom add\n"
+"      moveto\n"
+"\n"
+"      coord_c " << view_col << " add "
+   << map_rows-1-rb << " coord_r sub coord_label\n"
+"      dup stringwidth pop\n"
+"      coord_bearing rotate\n"
+"      0 coord_distance rmoveto\n"
+"      coord_bearing neg rotate\n"
+"      coord_tilt rotate\n"
+"      2 div neg 0 rmoveto\n"
+"      show\n"
+"      coord_tilt neg rotate\n"
+"   } for\n"
+"} for\n";
+      }
+      else {
+         out <<
+"/coord_text [\n";
 
-            switch (coord_first_style) {
-            case NoCoord:
-               break;
-            case Number:
-               if (coord_first_width) s << setw(coord_first_width);
-               if (coord_first_fill) s << setfill('0');
-               s << a;
-               break;
-            case Alpha:
-               s << alpha(a);
-               break;
-            case AlphaTally:
-               s << alpha_tally(a);
-               break;
-            }
-   
-            s << coord_fmt_inter;
-   
-            switch (coord_second_style) {
-            case NoCoord:
-               break;
-            case Number:
-               if (coord_second_width) s << setw(coord_second_width);
-               if (coord_second_fill) s << setfill('0');
-               s << b;
-               break;
-            case Alpha:
-               s << alpha(b);
-               break;
-            case AlphaTally:
-               s << alpha_tally(b);
-               break;
+         string s;
+         for (int c = 0; c < cols; ++c) {
+            const bool due = (c+view_col+coord_cstart) % coord_cskip == 0;
+            for (int r = 0, next = rs; r < rows; ++r) {
+               if (!due || r != next) {
+                  out << "() ";
+                  continue;
+               }
+               next += coord_rskip;
+
+               // rows are numbered down from the top of the whole map
+               labels.format(c+view_col, map_rows-1-(r+rb), s);
+               out << '(' << s << ") ";
             }
-   
-            out << '(' << s.str() << ") ";
+            out << '\n';
          }
-         out << '\n';
-      }
 
-      out <<
+         out <<
 "] def\n" 
 "\n"
 "/i 0 def\n"
@@ -481,6 +377,7 @@ void Grid::draw_ps()
 "\n"
 "   rmoveto\n"
 "} repeat\n";
+      }
    }
 
    out <<
@@ -492,7 +389,8 @@ void Grid::draw_ps()
 "%%Trailer\n"
 "cleartomark countdictstack exch sub { end } repeat restore\n"
 "%%EOF\n"
-      << endl;
+      << '\n';
+   out.close();
 
-   if (!outfile.empty()) out.close();
+   if (!out) throw runtime_error("error writing PostScript");
 }
@@ -0,0 +1,853 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "raster.h"
+
+// Pixel formats, each drawing pixel x of a row in its own layout. The
+// drawing loops are instantiated for each format, so that the format is
+// settled once for a run of pixels, not for every one.
+struct RgbaPixel {
+   static void put(unsigned char *row, int x, const Ramp &c, int level,
+                   bool blending)
+   {
+      unsigned char *p = row + size_t(x)*4;
+      const unsigned int sa = c.a[level];
+
+      if (!blending) {
+         // keep the more opaque of the two pixels
+         if (sa > p[3]) {
+            p[0] = c.r;
+            p[1] = c.g;
+            p[2] = c.b;
+            p[3] = sa;
+         }
+      }
+      else if (sa == 255 || (sa && p[3] == 0)) {
+         p[0] = c.r;
+         p[1] = c.g;
+         p[2] = c.b;
+         p[3] = sa;
+      }
+      else if (sa) {
+         if (p[3] == 255) {
+            const unsigned int da = 255 - sa;
+            p[0] = (c.pr[level] + p[0]*da + 127)/255;
+            p[1] = (c.pg[level] + p[1]*da + 127)/255;
+            p[2] = (c.pb[level] + p[2]*da + 127)/255;
+         }
+         else {
+            const unsigned int da = p[3]*(255 - sa),
+                               oa = 255*sa + da;
+            p[0] = (255*c.pr[level] + p[0]*da + oa/2)/oa;
+            p[1] = (255*c.pg[level] + p[1]*da + oa/2)/oa;
+            p[2] = (255*c.pb[level] + p[2]*da + oa/2)/oa;
+            p[3] = (oa + 127)/255;
+         }
+      }
+   }
+
+   static void set(unsigned char *row, int x, const Ramp &c)
+   {
+      unsigned char *p = row + size_t(x)*4;
+      p[0] = c.r;
+      p[1] = c.g;
+      p[2] = c.b;
+      p[3] = c.a[0];
+   }
+};
+
+struct GrayAlphaPixel {
+   static void put(unsigned char *row, int x, const Ramp &c, int level,
+                   bool blending)
+   {
+      unsigned char *p = row + size_t(x)*2;
+      const unsigned int sa = c.a[level];
+
+      if (!blending) {
+         if (sa > p[1]) {
+            p[0] = c.k;
+            p[1] = sa;
+         }
+      }
+      else if (sa == 255 || (sa && p[1] == 0)) {
+         p[0] = c.k;
+         p[1] = sa;
+      }
+      else if (sa) {
+         if (p[1] == 255) p[0] = (c.pk[level] + p[0]*(255 - sa) + 127)/255;
+         else {
+            const unsigned int da = p[1]*(255 - sa),
+                               oa = 255*sa + da;
+            p[0] = (255*c.pk[level] + p[0]*da + oa/2)/oa;
+            p[1] = (oa + 127)/255;
+         }
+      }
+   }
+
+   static void set(unsigned char *row, int x, const Ramp &c)
+   {
+      unsigned char *p = row + size_t(x)*2;
+      p[0] = c.k;
+      p[1] = c.a[0];
+   }
+};
+
+// always opaque, so always blended
+struct GrayPixel {
+   static void put(unsigned char *row, int x, const Ramp &c, int level, bool)
+   {
+      row[x] = (c.pk[level] + row[x]*(255 - c.a[level]) + 127)/255;
+   }
+
+   static void set(unsigned char *row, int x, const Ramp &c)
+   {
+      row[x] = (c.pk[0] + 127)/255;
+   }
+};
+
+struct IndexedPixel {
+   static void put(unsigned char *row, int x, const Ramp &c, int level, bool)
+   {
+      row[x] = c.over[row[x]*128 + level];
+   }
+
+   static void set(unsigned char *row, int x, const Ramp &c)
+   {
+      row[x] = c.solid;
+   }
+};
+
+struct BilevelPixel {
+   static void put(unsigned char *row, int x, const Ramp &c, int level, bool)
+   {
+      unsigned char &b = row[x >> 3];
+      const int s = 7 - (x & 7);
+      if (c.over[((b >> s) & 1)*128 + level]) b |= 1 << s;
+      else b &= ~(1 << s);
+   }
+
+   static void set(unsigned char *row, int x, const Ramp &c)
+   {
+      unsigned char &b = row[x >> 3];
+      const int s = 7 - (x & 7);
+      if (c.solid) b |= 1 << s;
+      else b &= ~(1 << s);
+   }
+};
+
+
+template <class P>
+static void run_row(unsigned char *row, int x1, int x2, const Ramp &c,
+                    int level, bool blending)
+{
+   for (int x = x1; x <= x2; ++x) P::put(row, x, c, level, blending);
+}
+
+
+template <class P>
+static void set_row(unsigned char *row, int x1, int x2, const Ramp &c)
+{
+   for (int x = x1; x <= x2; ++x) P::set(row, x, c);
+}
+
+
+template <class P>
+static void level_row(unsigned char *row, int x1, int x2,
+                      const unsigned char *l, const Ramp &c, bool blending)
+{
+   // level 127 draws nothing
+   for (int x = x1; x <= x2; ++x, ++l)
+      if (*l < 127) P::put(row, x, c, *l, blending);
+}
+
+
+static int bits(Raster::Format f)
+{
+   switch (f) {
+   case Raster::RGBA:      return 32;
+   case Raster::GrayAlpha: return 16;
+   case Raster::Bilevel:   return 1;
+   default:                return 8;
+   }
+}
+
+
+Raster::Raster(int w, int h, int n, Format f)
+ : w(w), h(h), fmt(f), stride((size_t(w)*bits(f) + 7)/8),
+   y0(0), top(0), bottom(-1), blending(true),
+   store(stride*max(min(n, h), 0)), buf(store.empty() ? 0 : &store[0])
+{
+   // start out opaque black, as GD does
+   if (f == RGBA || f == GrayAlpha) {
+      const size_t step = bits(f)/8;
+      for (size_t i = step-1; i < store.size(); i += step) store[i] = 255;
+   }
+
+   window(0);
+}
+
+
+Raster::Raster(Raster &r, int y1, int y2)
+ : w(r.w), h(r.h), fmt(r.fmt), stride(r.stride), y0(r.y0),
+   top(max(y1, r.top)), bottom(min(y2, r.bottom)),
+   blending(r.blending), buf(r.buf)
+{
+}
+
+
+void Raster::window(int y)
+{
+   y0 = top = y;
+   bottom = min(y + int(store.size()/max(stride, size_t(1))), h) - 1;
+}
+
+
+Ramp Raster::ramp(unsigned int rgb, unsigned int opacity)
+{
+   Ramp c;
+   c.r = (rgb >> 16) & 0xff;
+   c.g = (rgb >>  8) & 0xff;
+   c.b =  rgb        & 0xff;
+   c.k = (299*c.r + 587*c.g + 114*c.b + 500)/1000;
+   c.solid = 0;
+
+   for (unsigned int l = 0; l < 128; ++l) {
+      // combine coverage and opacity, then widen 7-bit GD alpha to 8 bits
+      // by repeating the MSB as the LSB, as GD does when writing PNGs
+      const unsigned int ga = 127 - (127 - l)*(127 - opacity)/127;
+      c.a[l] = 255 - ((ga << 1) + (ga >> 6));
+      c.pr[l] = c.r*c.a[l];
+      c.pg[l] = c.g*c.a[l];
+      c.pb[l] = c.b*c.a[l];
+      c.pk[l] = c.k*c.a[l];
+   }
+
+   return c;
+}
+
+
+// the RGBA color made by drawing c over p at a level
+static unsigned int over(unsigned int p, const Ramp &c, int level,
+                         bool blending)
+{
+   unsigned char q[4] = {
+      (unsigned char) (p >> 24), (unsigned char) (p >> 16),
+      (unsigned char) (p >> 8), (unsigned char) p
+   };
+   RgbaPixel::put(q, 0, c, level, blending);
+   return (q[0] << 24) | (q[1] << 16) | (q[2] << 8) | q[3];
+}
+
+
+vector<unsigned char> Raster::palette(Format f, bool blending,
+                                      bool antialiased,
+                                      const vector<Ramp *> &grounds,
+                                      const vector<Ramp *> &inks)
+{
+   vector<Ramp *> all(grounds);
+   all.insert(all.end(), inks.begin(), inks.end());
+
+   if (f == Bilevel) {
+      // Grounds are black or white by their luma. An ink is drawn where it
+      // covers at least half of a pixel, in black if it is darker than the
+      // background and white if it is lighter.
+      for (size_t i = 0; i < all.size(); ++i) {
+         Ramp &c = *all[i];
+         const int k = all[0]->k;
+         c.solid = i < grounds.size() ? c.k >= 128 :
+                   c.k == k ? k >= 128 : c.k > k;
+
+         c.over.resize(2*128);
+         for (int b = 0; b < 2; ++b)
+            for (int l = 0; l < 128; ++l)
+               c.over[b*128 + l] = c.a[l] >= 128 ? c.solid : b;
+      }
+
+      static const unsigned char bw[8] = { 0, 0, 0, 255, 255, 255, 255, 255 };
+      return vector<unsigned char>(bw, bw+8);
+   }
+
+   // Find the colors made by drawing each ink in turn over those made
+   // before it, at q levels of coverage, with as many levels as fit.
+   vector<unsigned int> pal;
+   for (int q = antialiased ? 127 : 1; q > 0; --q) {
+      vector<int> levels;
+      if (antialiased) {
+         for (int k = 1; k <= q; ++k) levels.push_back(127 - (127*k + q/2)/q);
+      }
+      else levels.push_back(0);
+
+      map<unsigned int, int> seen;
+      pal.clear();
+      for (size_t i = 0; i < grounds.size(); ++i) {
+         const Ramp &c = *grounds[i];
+         const unsigned int g = (c.r << 24) | (c.g << 16) | (c.b << 8) | c.a[0];
+         if (seen.insert(make_pair(g, int(pal.size()))).second) pal.push_back(g);
+      }
+
+      for (size_t i = 0; i < inks.size() && pal.size() <= 256; ++i) {
+         const size_t n = pal.size();
+         for (size_t j = 0; j < n && pal.size() <= 256; ++j) {
+            for (size_t k = 0; k < levels.size(); ++k) {
+               const unsigned int o = over(pal[j], *inks[i], levels[k],
+                                           blending);
+               if (seen.insert(make_pair(o, int(pal.size()))).second)
+                  pal.push_back(o);
+            }
+         }
+      }
+
+      if (pal.size() <= 256) break;
+   }
+
+   if (pal.size() > 256) throw runtime_error("too many colors for a palette");
+
+   // Colors which were left out, by telling fewer levels apart, become
+   // the nearest one kept.
+   map<unsigned int, int> nearest;
+   for (size_t i = 0; i < pal.size(); ++i) nearest[pal[i]] = i;
+
+   for (size_t i = 0; i < all.size(); ++i) {
+      Ramp &c = *all[i];
+      c.over.resize(pal.size()*128);
+
+      for (size_t j = 0; j <= pal.size(); ++j) {
+         for (int l = 0; l < 128; ++l) {
+            // the last pass finds the color itself
+            const unsigned int o = j < pal.size() ?
+               over(pal[j], c, l, blending) :
+               (c.r << 24) | (c.g << 16) | (c.b << 8) | c.a[0];
+
+            map<unsigned int, int>::iterator m = nearest.find(o);
+            if (m == nearest.end()) {
+               int best = 0;
+               long least = -1;
+               for (size_t k = 0; k < pal.size(); ++k) {
+                  long d = 0;
+                  for (int s = 0; s < 32; s += 8) {
+                     const long e = long((o >> s) & 0xff) -
+                                    long((pal[k] >> s) & 0xff);
+                     d += e*e;
+                  }
+
+                  if (least < 0 || d < least) {
+                     least = d;
+                     best = k;
+                  }
+               }
+
+               m = nearest.insert(make_pair(o, best)).first;
+            }
+
+            if (j < pal.size()) c.over[j*128 + l] = m->second;
+            else {
+               c.solid = m->second;
+               break;
+            }
+         }
+      }
+   }
+
+   vector<unsigned char> rgba;
+   for (size_t i = 0; i < pal.size(); ++i) {
+      for (int s = 24; s >= 0; s -= 8) rgba.push_back((pal[i] >> s) & 0xff);
+   }
+
+   return rgba;
+}
+
+
+Sprite Raster::sprite(int w, int h, const vector<unsigned char> &level,
+                      const Ramp &c)
+{
+   Sprite s;
+   s.w = w;
+   s.h = h;
+   s.level = level;
+   s.pre.resize(level.size()*4);
+   s.keep.resize(level.size()*4);
+
+   for (size_t i = 0; i < level.size(); ++i) {
+      const int l = level[i];
+      s.pre[i*4]   = c.pr[l];
+      s.pre[i*4+1] = c.pg[l];
+      s.pre[i*4+2] = c.pb[l];
+      s.pre[i*4+3] = 255*c.a[l];
+      fill_n(&s.keep[i*4], 4, 255 - c.a[l]);
+   }
+
+   return s;
+}
+
+
+Sprite Raster::sprite(int w, int h, const vector<Segment> &segs,
+                      double thick, const Ramp &c)
+{
+   Raster r(w, h, h);
+   vector<unsigned char> level(size_t(w)*h, 127);
+   if (!level.empty()) r.sweep(segs, thick, 0, &level[0]);
+   return sprite(w, h, level, c);
+}
+
+
+void Raster::fill(int x1, int y1, int x2, int y2, const Ramp &c)
+{
+   if (x1 > x2) swap(x1, x2);
+   if (y1 > y2) swap(y1, y2);
+   if (x1 < 0) x1 = 0;
+   if (y1 < top) y1 = top;
+   if (x2 >= w) x2 = w-1;
+   if (y2 > bottom) y2 = bottom;
+   if (x1 > x2) return;
+
+   for (int y = y1; y <= y2; ++y) {
+      // fills overwrite when not blending
+      if (blending) run(y, x1, x2, c, 0);
+      else set(y, x1, x2, c);
+   }
+}
+
+
+void Raster::span(int x1, int x2, int y, const Ramp &c, int level)
+{
+   if (y < top || y > bottom) return;
+   if (x1 > x2) swap(x1, x2);
+   if (x1 < 0) x1 = 0;
+   if (x2 >= w) x2 = w-1;
+   if (x1 > x2) return;
+
+   run(y, x1, x2, c, level);
+}
+
+
+void Raster::pixel(int x, int y, const Ramp &c, int level)
+{
+   if (x < 0 || y < top || x >= w || y > bottom) return;
+   run(y, x, x, c, level);
+}
+
+
+void Raster::run(int y, int x1, int x2, const Ramp &c, int level)
+{
+   unsigned char *r = &buf[size_t(y - y0)*stride];
+
+   switch (fmt) {
+   case RGBA:
+      run_row<RgbaPixel>(r, x1, x2, c, level, blending);
+      break;
+   case GrayAlpha:
+      run_row<GrayAlphaPixel>(r, x1, x2, c, level, blending);
+      break;
+   case Gray:
+      run_row<GrayPixel>(r, x1, x2, c, level, blending);
+      break;
+   case Indexed:
+      run_row<IndexedPixel>(r, x1, x2, c, level, blending);
+      break;
+   case Bilevel:
+      run_row<BilevelPixel>(r, x1, x2, c, level, blending);
+      break;
+   }
+}
+
+
+void Raster::set(int y, int x1, int x2, const Ramp &c)
+{
+   unsigned char *r = &buf[size_t(y - y0)*stride];
+
+   switch (fmt) {
+   case RGBA:      set_row<RgbaPixel>(r, x1, x2, c);      break;
+   case GrayAlpha: set_row<GrayAlphaPixel>(r, x1, x2, c); break;
+   case Gray:      set_row<GrayPixel>(r, x1, x2, c);      break;
+   case Indexed:   set_row<IndexedPixel>(r, x1, x2, c);   break;
+   case Bilevel:   set_row<BilevelPixel>(r, x1, x2, c);   break;
+   }
+}
+
+
+void Raster::levels(int y, int x1, int x2, const unsigned char *l,
+                    const Ramp &c)
+{
+   unsigned char *r = &buf[size_t(y - y0)*stride];
+
+   switch (fmt) {
+   case RGBA:
+      level_row<RgbaPixel>(r, x1, x2, l, c, blending);
+      break;
+   case GrayAlpha:
+      level_row<GrayAlphaPixel>(r, x1, x2, l, c, blending);
+      break;
+   case Gray:
+      level_row<GrayPixel>(r, x1, x2, l, c, blending);
+      break;
+   case Indexed:
+      level_row<IndexedPixel>(r, x1, x2, l, c, blending);
+      break;
+   case Bilevel:
+      level_row<BilevelPixel>(r, x1, x2, l, c, blending);
+      break;
+   }
+}
+
+
+void Raster::line(int x1, int y1, int x2, int y2, int thick, const Ramp &c)
+{
+   // Bresenham with a perpendicular run for thickness, following
+   // gdImageLine() in gd-2.0.33
+   if (thick < 1) thick = 1;
+
+   int dx = abs(x2 - x1),
+       dy = abs(y2 - y1);
+
+   if (dy == 0) {
+      fill(x1, y1 - thick/2, x2, y1 + thick - thick/2 - 1, c);
+      return;
+   }
+
+   if (dx == 0) {
+      fill(x1 - thick/2, y1, x1 + thick - thick/2 - 1, y2, c);
+      return;
+   }
+
+   if (dy <= dx) {
+      // mostly horizontal, so use a vertical run for thickness
+      int wid = int(thick/cos(atan2(double(dy), double(dx))));
+      if (wid == 0) wid = 1;
+
+      if (x1 > x2) {
+         swap(x1, x2);
+         swap(y1, y2);
+      }
+
+      const int ydir = y2 > y1 ? 1 : -1;
+      int d = 2*dy - dx;
+
+      for (int x = x1, y = y1; ; ) {
+         for (int v = y - wid/2; v < y - wid/2 + wid; ++v) pixel(x, v, c);
+         if (x == x2) break;
+         ++x;
+         if (d < 0) d += 2*dy;
+         else {
+            y += ydir;
+            d += 2*(dy - dx);
+         }
+      }
+   }
+   else {
+      // mostly vertical, so use a horizontal run for thickness
+      int wid = int(thick/sin(atan2(double(dy), double(dx))));
+      if (wid == 0) wid = 1;
+
+      if (y1 > y2) {
+         swap(x1, x2);
+         swap(y1, y2);
+      }
+
+      const int xdir = x2 > x1 ? 1 : -1;
+      int d = 2*dx - dy;
+
+      for (int x = x1, y = y1; ; ) {
+         span(x - wid/2, x - wid/2 + wid - 1, y, c);
+         if (y == y2) break;
+         ++y;
+         if (d < 0) d += 2*dx;
+         else {
+            x += xdir;
+            d += 2*(dx - dy);
+         }
+      }
+   }
+}
+
+
+void Raster::ellipse(int cx, int cy, int ew, int eh, const Ramp &c)
+{
+   const double a = ew/2.0,
+                b = eh/2.0;
+
+   for (int y = -int(b); y <= int(b); ++y) {
+      const int x = b ? int(a*sqrt(1 - (y*y)/(b*b))) : int(a);
+      span(cx - x, cx + x, cy + y, c);
+   }
+}
+
+
+void Raster::mask(int x, int y, int mw, int mh, const unsigned char *m,
+                  const Ramp &c)
+{
+   const int i1 = max(0, -x), i2 = min(mw, w - x),
+             j1 = max(0, top - y), j2 = min(mh, bottom + 1 - y);
+   if (i1 >= i2) return;
+
+   vector<unsigned char> l(i2 - i1);
+   for (int j = j1; j < j2; ++j) {
+      // mask coverage 0-255 to GD levels 127-0
+      const unsigned char *q = &m[size_t(j)*mw];
+      for (int i = i1; i < i2; ++i) l[i - i1] = 127 - (q[i]*127 + 127)/255;
+      levels(y + j, x + i1, x + i2 - 1, &l[0], c);
+   }
+}
+
+
+void Raster::paint(int x, int y, const Sprite &s, const Ramp &c)
+{
+   const int i1 = max(0, -x), i2 = min(s.w, w - x),
+             j1 = max(0, top - y), j2 = min(s.h, bottom + 1 - y);
+   if (i1 >= i2) return;
+
+   for (int j = j1; j < j2; ++j) {
+      if (fmt == RGBA && blending) {
+         unsigned char *p = &buf[size_t(y + j - y0)*stride + size_t(x + i1)*4];
+         const int n = (i2 - i1)*4;
+
+         unsigned char opaque = 255;
+         for (int k = 3; k < n; k += 4) opaque &= p[k];
+
+         if (opaque == 255) {
+            // Over opaque pixels, every level blends the same way, so the
+            // row needs no branches and the compiler can vectorize it.
+            const size_t o = (size_t(j)*s.w + i1)*4;
+            const unsigned short *pre = &s.pre[o], *keep = &s.keep[o];
+            for (int k = 0; k < n; ++k)
+               p[k] = (pre[k] + p[k]*(unsigned int)keep[k] + 127)/255;
+            continue;
+         }
+      }
+
+      levels(y + j, x + i1, x + i2 - 1, &s.level[size_t(j)*s.w + i1], c);
+   }
+}
+
+
+void Raster::blit(int x, int y, const Raster &src, int sx, int sy,
+                  int bw, int bh)
+{
+   if (x < 0) {
+      sx -= x;
+      bw += x;
+      x = 0;
+   }
+
+   if (y < top) {
+      sy += top - y;
+      bh -= top - y;
+      y = top;
+   }
+
+   bw = min(bw, w - x);
+   bh = min(bh, bottom + 1 - y);
+   if (bw <= 0) return;
+
+   const int b = bits(fmt);
+   for (int j = 0; j < bh; ++j) {
+      const unsigned char *p = src.row(sy + j);
+      unsigned char *q = &buf[size_t(y + j - y0)*stride];
+
+      if (b >= 8) {
+         p += size_t(sx)*b/8;
+         copy(p, p + size_t(bw)*b/8, q + size_t(x)*b/8);
+      }
+      else {
+         for (int i = 0; i < bw; ++i) {
+            const int s = sx + i, d = x + i;
+            if (p[s >> 3] & (0x80 >> (s & 7))) q[d >> 3] |= 0x80 >> (d & 7);
+            else q[d >> 3] &= ~(0x80 >> (d & 7));
+         }
+      }
+   }
+}
+
+
+void Raster::stroke(const vector<Segment> &segs, double thick, const Ramp &c)
+{
+   sweep(segs, thick, &c, 0);
+}
+
+
+void Raster::sweep(const vector<Segment> &segs, double thick, const Ramp *c,
+                   unsigned char *level)
+{
+   // Coverage of every segment crossing a scanline is gathered into one
+   // buffer, keeping the maximum where segments meet, and the scanline is
+   // then blended once. Joins at hex vertices come out round and are never
+   // blended twice.
+   const float r = thick/2 + 0.5;
+
+   // order the segments by the first scanline they touch
+   vector<pair<int, int> > order;   // (first scanline, last scanline)
+   vector<size_t> index;
+   {
+      vector<pair<pair<int, int>, size_t> > tmp;
+      for (size_t i = 0; i < segs.size(); ++i) {
+         const int y1 = int(floor(min(segs[i].y1, segs[i].y2) - r)),
+                   y2 = int(ceil(max(segs[i].y1, segs[i].y2) + r));
+         if (y2 < top || y1 > bottom) continue;
+         tmp.push_back(make_pair(make_pair(max(y1, top), min(y2, bottom)), i));
+      }
+
+      sort(tmp.begin(), tmp.end());
+
+      for (size_t i = 0; i < tmp.size(); ++i) {
+         order.push_back(tmp[i].first);
+         index.push_back(tmp[i].second);
+      }
+   }
+
+   vector<float> cov(w, 0);
+   vector<unsigned char> l(w);
+   vector<size_t> active;
+   size_t next = 0;
+
+   for (int y = order.empty() ? bottom+1 : order[0].first;
+        y <= bottom && (next < order.size() || !active.empty()); ++y) {
+      while (next < order.size() && order[next].first <= y)
+         active.push_back(next++);
+
+      int xlo = w, xhi = -1;
+      for (size_t k = 0; k < active.size(); ) {
+         if (order[active[k]].second < y) {
+            active[k] = active.back();
+            active.pop_back();
+            continue;
+         }
+
+         cover(segs[index[active[k]]], y, r, &cov[0], xlo, xhi);
+         ++k;
+      }
+
+      // blend the scanline, or just keep its levels
+      if (level) {
+         unsigned char *q = &level[size_t(y - y0)*w];
+         for (int x = xlo; x <= xhi; ++x) {
+            if (cov[x] > 0) {
+               q[x] = 127 - int(cov[x]*127 + 0.5f);
+               cov[x] = 0;
+            }
+         }
+      }
+      else if (xlo <= xhi) {
+         for (int x = xlo; x <= xhi; ++x) {
+            l[x - xlo] = cov[x] > 0 ? 127 - int(cov[x]*127 + 0.5f) : 127;
+            cov[x] = 0;
+         }
+         levels(y, xlo, xhi, &l[0], *c);
+      }
+   }
+}
+
+
+void Raster::cover(const Segment &s, int y, float r, float *cov,
+                   int &xlo, int &xhi) const
+{
+   const double dx = s.x2 - s.x1,
+                dy = s.y2 - s.y1,
+                len = sqrt(dx*dx + dy*dy);
+
+   // find the pixels on this scanline within r of the segment
+   double xa, xb;
+   if (dy == 0) {
+      if (fabs(y - s.y1) >= r) return;
+      xa = min(s.x1, s.x2);
+      xb = max(s.x1, s.x2);
+   }
+   else {
+      double ta = (y - r - s.y1)/dy,
+             tb = (y + r - s.y1)/dy;
+      if (ta > tb) swap(ta, tb);
+      if (tb < 0 || ta > 1) return;
+      ta = max(ta, 0.0);
+      tb = min(tb, 1.0);
+      xa = min(s.x1 + ta*dx, s.x1 + tb*dx);
+      xb = max(s.x1 + ta*dx, s.x1 + tb*dx);
+   }
+
+   const int x1 = max(int(floor(xa - r)), 0),
+             x2 = min(int(ceil(xb + r)), w-1);
+   if (x1 > x2) return;
+
+   xlo = min(xlo, x1);
+   xhi = max(xhi, x2);
+
+   // The body of the segment is where the pixel projects between the
+   // endpoints. There the distance is perpendicular and linear in x.
+   int b1 = x2+1, b2 = x2;
+   double ux = 0, uy = 0;
+   if (len > 0) {
+      ux = dx/len;
+      uy = dy/len;
+
+      const double u = (x1 - s.x1)*ux + (y - s.y1)*uy;
+      if (ux == 0) {
+         if (u >= 0 && u <= len) {
+            b1 = x1;
+            b2 = x2;
+         }
+      }
+      else {
+         double e1 = x1 + (0 - u)/ux,
+                e2 = x1 + (len - u)/ux;
+         if (e1 > e2) swap(e1, e2);
+
+         // nearly vertical segments put these far off
+         b1 = e1 > x1 ? int(ceil(e1)) : x1;
+         b2 = e2 < x2 ? int(floor(e2)) : x2;
+      }
+   }
+
+   if (b1 <= b2) {
+      const float v0 = -(b1 - s.x1)*uy + (y - s.y1)*ux,
+                  dv = -uy;
+      float *cv = cov + b1;
+      const int n = b2 - b1 + 1;
+
+      for (int i = 0; i < n; ++i) {
+         float k = r - fabsf(v0 + i*dv);
+         k = k < 0 ? 0 : (k > 1 ? 1 : k);
+         cv[i] = cv[i] > k ? cv[i] : k;
+      }
+   }
+   else {
+      b1 = x2+1;
+      b2 = x2;
+   }
+
+   // the caps beyond either end are round
+   for (int x = x1; x <= x2; ++x) {
+      if (x == b1) {
+         x = b2;
+         continue;
+      }
+
+      const double ax = x - s.x1, ay = y - s.y1,
+                   bx = x - s.x2, by = y - s.y2,
+                   d = sqrt(min(ax*ax + ay*ay, bx*bx + by*by));
+      const float k = min(max(r - d, 0.0), 1.0);
+      if (k > cov[x]) cov[x] = k;
+   }
+}
@@ -0,0 +1,179 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __RASTER_H_
+#define __RASTER_H_
+
+#include <vector>
+using namespace std;
+
+//
+// A drawing color with its alpha ramp precomputed. Levels follow the GD
+// alpha convention used by the opacity options: level 0 is full coverage,
+// level 127 is no coverage. The color's own opacity is folded into every
+// level, and each entry holds 8-bit PNG alpha (255 is opaque) along with
+// the color premultiplied by that alpha.
+//
+// For grayscale rasters, the color's luma is kept in the same way. For
+// indexed rasters, the ramp holds what each palette entry becomes when
+// the color is drawn over it at each level.
+//
+struct Ramp {
+   unsigned char r, g, b;
+   unsigned char a[128];
+   unsigned short pr[128], pg[128], pb[128];
+
+   unsigned char k;                 // luma
+   unsigned short pk[128];
+
+   unsigned char solid;             // the entry for the color itself
+   vector<unsigned char> over;      // the entry drawn over entry i at
+                                    // level l, at over[i*128 + l]
+};
+
+//
+// A line segment to be stroked, in pixel coordinates.
+//
+struct Segment {
+   double x1, y1, x2, y2;
+};
+
+//
+// A small picture drawn many times, such as a center marker. It holds the
+// GD level of each pixel, 127 where nothing is drawn, and for blending
+// over opaque pixels, each channel premultiplied by its color's alpha
+// along with what remains of the pixel beneath.
+//
+struct Sprite {
+   int w, h;
+   vector<unsigned char> level;
+   vector<unsigned short> pre, keep;
+};
+
+//
+// A contiguous framebuffer.
+//
+// The framebuffer holds a strip of at most n scanlines of a w by h image,
+// so that large images can be drawn and written a strip at a time.
+// Coordinates are always those of the whole image.
+//
+// Pixels are held in one of several formats, the smaller ones for grids
+// needing few colors. Each row is laid out as a PNG row of that format
+// would be, except that RGBA is kept even for opaque images.
+//
+class Raster {
+   public:
+      enum Format {
+         RGBA,          // 8-bit red, green, blue and alpha
+         GrayAlpha,     // 8-bit luma and alpha
+         Gray,          // 8-bit luma
+         Indexed,       // 8-bit palette entries
+         Bilevel        // 1-bit black or white, packed high bit first
+      };
+
+      Raster(int w, int h, int n, Format f = RGBA);
+
+      // a band of rows y1 to y2 of another raster, sharing its pixels
+      Raster(Raster &r, int y1, int y2);
+
+      int width() const  { return w; }
+      int height() const { return h; }
+      Format format() const { return fmt; }
+
+      // the rows held at present
+      int first() const { return top; }
+      int last() const  { return bottom; }
+
+      // hold the rows from y on, which are left as the last rows held
+      // were drawn, so must be drawn over completely
+      void window(int y);
+
+      // blend into existing pixels (as GD does with alpha blending on), or
+      // replace them when more opaque (for transparent backgrounds)
+      void alpha_blending(bool b) { blending = b; }
+
+      // a row held at present
+      const unsigned char *row(int y) const {
+         return &buf[size_t(y - y0)*stride];
+      }
+
+      static Ramp ramp(unsigned int rgb, unsigned int opacity);
+
+      // Indexed and bilevel rasters need their palette before drawing
+      // starts: every color which the inks, drawn in order over any of
+      // the grounds, can make. Where there would be more than 256, fewer
+      // levels of coverage are told apart. Bilevel rasters are just black
+      // and white, with inks in whichever stands out from the first
+      // ground. Fills the ramps' tables, and returns the palette as RGBA.
+      static vector<unsigned char> palette(Format f, bool blending,
+                                           bool antialiased,
+                                           const vector<Ramp *> &grounds,
+                                           const vector<Ramp *> &inks);
+
+      // a w by h sprite in one color, from its levels or from antialiased
+      // lines stroked into it
+      static Sprite sprite(int w, int h, const vector<unsigned char> &level,
+                           const Ramp &c);
+      static Sprite sprite(int w, int h, const vector<Segment> &segs,
+                           double thick, const Ramp &c);
+
+      void fill(int x1, int y1, int x2, int y2, const Ramp &c);
+      void span(int x1, int x2, int y, const Ramp &c, int level = 0);
+      void line(int x1, int y1, int x2, int y2, int thick, const Ramp &c);
+      void ellipse(int cx, int cy, int w, int h, const Ramp &c);
+      void pixel(int x, int y, const Ramp &c, int level = 0);
+
+      // composite an 8-bit coverage mask, such as a glyph
+      void mask(int x, int y, int mw, int mh, const unsigned char *m,
+                const Ramp &c);
+
+      // composite a sprite made in color c
+      void paint(int x, int y, const Sprite &s, const Ramp &c);
+
+      // copy a block of pixels from another raster
+      void blit(int x, int y, const Raster &src, int sx, int sy,
+                int bw, int bh);
+
+      // antialiased lines of any thickness, all stroked in one pass
+      void stroke(const vector<Segment> &segs, double thick, const Ramp &c);
+
+   private:
+      void run(int y, int x1, int x2, const Ramp &c, int level);
+      void set(int y, int x1, int x2, const Ramp &c);
+      void levels(int y, int x1, int x2, const unsigned char *l,
+                  const Ramp &c);
+      void sweep(const vector<Segment> &segs, double thick, const Ramp *c,
+                 unsigned char *level);
+      void cover(const Segment &s, int y, float r, float *cov,
+                 int &xlo, int &xhi) const;
+
+      Raster(const Raster &);
+      Raster &operator=(const Raster &);
+
+      int w, h;
+      Format fmt;
+      size_t stride;       // bytes per row
+      int y0;              // first row of the strip
+      int top, bottom;     // rows which may be drawn
+      bool blending;
+      vector<unsigned char> store;
+      unsigned char *buf;
+};
+
+#endif /* __RASTER_H_ */
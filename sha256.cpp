@@ -0,0 +1,118 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "sha256.h"
+
+//
+// SHA-256, as given in FIPS 180-4. It is used only to name what is kept
+// in the render cache, so it is written for clarity, not speed.
+//
+
+static const uint32_t k[64] = {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+   0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+   0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+   0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+   0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+   0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n)
+{
+   return (x >> n) | (x << (32 - n));
+}
+
+// mix one 64-byte block into the hash
+static void block(uint32_t h[8], const unsigned char *p)
+{
+   uint32_t w[64];
+   for (int t = 0; t < 16; ++t) {
+      w[t] = uint32_t(p[4*t]) << 24 | uint32_t(p[4*t+1]) << 16 |
+             uint32_t(p[4*t+2]) << 8 | uint32_t(p[4*t+3]);
+   }
+
+   for (int t = 16; t < 64; ++t) {
+      const uint32_t s0 = rotr(w[t-15], 7) ^ rotr(w[t-15], 18) ^
+                          (w[t-15] >> 3),
+                     s1 = rotr(w[t-2], 17) ^ rotr(w[t-2], 19) ^
+                          (w[t-2] >> 10);
+      w[t] = w[t-16] + s0 + w[t-7] + s1;
+   }
+
+   uint32_t a = h[0], b = h[1], c = h[2], d = h[3],
+            e = h[4], f = h[5], g = h[6], hh = h[7];
+
+   for (int t = 0; t < 64; ++t) {
+      const uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+                          ((e & f) ^ (~e & g)) + k[t] + w[t],
+                     t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+      hh = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+   }
+
+   h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+   h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+
+string sha256(const string &str)
+{
+   uint32_t h[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+   };
+
+   // pad with a 1 bit, then 0s, then the length in bits, to a whole block
+   string m(str);
+   const uint64_t bits = uint64_t(str.size()) * 8;
+   m += char(0x80);
+   while (m.size() % 64 != 56) m += char(0);
+   for (int s = 56; s >= 0; s -= 8) m += char(bits >> s);
+
+   for (size_t i = 0; i < m.size(); i += 64)
+      block(h, (const unsigned char *) m.data() + i);
+
+   static const char hex[] = "0123456789abcdef";
+   string d;
+   for (int i = 0; i < 8; ++i) {
+      for (int s = 28; s >= 0; s -= 4) d += hex[(h[i] >> s) & 0xf];
+   }
+   return d;
+}
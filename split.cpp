@@ -0,0 +1,36 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "split.h"
+
+vector<string> split(const string &str, char sep)
+{
+   vector<string> pieces;
+   string::size_type b = 0, e;
+   while ((e = str.find(sep, b)) != string::npos) {
+      pieces.push_back(str.substr(b, e-b));
+      b = e+1;
+   }
+   pieces.push_back(str.substr(b));
+   return pieces;
+}
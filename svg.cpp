@@ -21,25 +21,23 @@
 #include <iostream>
 #include <iomanip>
 #include <exception>
-#include <fstream>
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <vector>
 using namespace std;
 
 #include "grid.h"
+#include "textwriter.h"
 
-ofstream out;
+thread_local TextWriter out;   // where the SVG this thread draws goes
 
-void Grid::draw_svg()
+void Grid::draw_svg(ostream &os)
 {
-   if (outfile.empty() || outfile == "-") out.ostream::rdbuf(cout.rdbuf());
-   else {
-      filebuf *buf = new filebuf;
-      buf->open(outfile.c_str(), ios::out | ios::binary);
-      out.ostream::rdbuf(buf);
-      if (!out) throw runtime_error("cannot write to " + outfile);
-   }
+   out.open(os, precision);
+
+   // hexes are placed within the grid group, which holds the margins
+   layout = HexLayout(hw, hh, 0, 0, cols, rows, lowfirstcol);
 
    // write header
    out << "<?xml version=\"1.0\" standalone=\"no\"?>\n"
@@ -55,7 +53,7 @@ void Grid::draw_svg()
    out << "<defs>\n";
 
    // center definition
-   if (center_style != Centerless) {
+   if (center_style != Centerless && !svg_pattern) {
       switch (center_style) {
       case Cross:
          out << "<path id=\"cross\" d=\""
@@ -67,8 +65,8 @@ void Grid::draw_svg()
 
          out << "<g id=\"c-row\">\n";
          for (int c = 0; c < cols; ++c) {
-            out << "<use x=\"" << (c*0.75 + 0.5)*hw << "\" "
-                   "y=\"" << 0.5*hh*((c+lowfirstcol)%2) << "\" "
+            out << "<use x=\"" << layout.x(c) << "\" "
+                   "y=\"" << layout.y(c, 0) - 0.5*hh << "\" "
                    "xlink:href=\"#cross\" />\n";
          }
          out << "</g>\n";
@@ -76,8 +74,8 @@ void Grid::draw_svg()
       case Dot:
          out << "<g id=\"c-row\">\n";
          for (int c = 0; c < cols; ++c) {
-            out << "<circle cx=\"" << (c*0.75 + 0.5)*hw
-                << "\" cy=\"" << 0.5*hh*((c+lowfirstcol)%2)
+            out << "<circle cx=\"" << layout.x(c)
+                << "\" cy=\"" << layout.y(c, 0) - 0.5*hh
                 << "\" r=\"" << center_size << "\" />\n";
          }
          out << "</g>\n";
@@ -87,48 +85,35 @@ void Grid::draw_svg()
       }
    }
  
-   // grid definition
-   if (lowfirstcol == true) {
-      out << "<path id=\"bottoms\" d=\"M 0 0"; 
-      for (int n = 0; n <= 2*cols-3; ++n) side_skip_path_svg(n);
-      out << "\" />\n";
+   // grid definition, from a mesh of the whole grid: the upper left, top
+   // and lower left sides of the first row are the same in every row, so
+   // they are defined once and used for each, and the sides which no row
+   // has that way close the grid
+   HexMesh mesh;
+   layout.build(0, cols-1, 0, rows-1, true, mesh);
+
+   vector<unsigned int> row, closing, outline;
+   for (size_t k = 0; k < mesh.id.size(); ++k) {
+      int c, r, s;
+      layout.side_of(mesh.id[k], c, r, s);
+      if (layout.outer(c, r, s)) outline.push_back(k);
+      if (s >= 2 && s <= 4) closing.push_back(k);
+      else if (r == 0) row.push_back(k);
+   }
 
-      out << "<path id=\"tops\" d=\"M 0 0 l";
-      for (int n = 1; n <= 2*cols - 1; ++n) side_path_svg(n);
+   if (svg_pattern) {
+      out << "<path id=\"outline\" d=\"";
+      sides_svg(mesh, outline);
       out << "\" />\n";
-
-      out << "<path id=\"outline\" d=\"M 0 0 l";
-      for (int n = 1; n <= 2*cols-cols%2; ++n)
-         side_path_svg(n);
-      for (int n = cols%2; n <= 2*rows-2+cols%2; ++n)
-         edge_path_svg(n);
-      for (int n = 3+(cols%2); n <= 2*cols+1+2*(cols%2); ++n)
-         side_path_reverse_svg(n);
-      for (int n = 0; n <= 2*rows-2; ++n)
-         edge_path_reverse_svg(n);
-      out << " z\" />\n";
    }
    else {
-      out << "<path id=\"bottoms\" d=\"M 0 0";
-      for (int n = 2; n <= 2*cols-1; ++n) side_skip_path_svg(n);
-      out << "\" />\n";
-
-      out << "<path id=\"tops\" d=\"M 0 0 l";
-      for (int n = 3; n <= 2*cols + 1; ++n) side_path_svg(n);
+      out << "<path id=\"row\" d=\"";
+      sides_svg(mesh, row);
       out << "\" />\n";
-
-      out << "<path id=\"outline\" d=\"M 0 0 l";
-      for (int n = 2; n <= 2*cols+2-(cols+1)%2; ++n)
-         side_path_svg(n);
-      for (int n = 1-cols%2; n <= 2*rows-1-cols%2; ++n)
-         edge_path_svg(n);
-      for (int n = 3*(cols%2); n <= 2*cols-1+2*(cols%2); ++n)
-         side_path_reverse_svg(n);
-      for (int n = 0; n <= 2*rows-3; ++n)
-         edge_path_reverse_svg(n);
-      out << " z\" />\n";
    }
 
+   if (svg_pattern) pattern_svg();
+
    out << "</defs>\n";
 
    // draw background
@@ -156,6 +141,13 @@ void Grid::draw_svg()
           << mtop+grid_thickness/2 << ")\">\n";
    }
 
+   // the inside of the grid is one rectangle, filled with the pattern
+   if (svg_pattern) {
+      out << "<rect width=\"" << (0.25+0.75*cols)*hw << "\" "
+             "height=\"" << (rows+1)*hh << "\" "
+             "fill=\"url(#hexes)\" clip-path=\"url(#inside)\" />\n";
+   }
+
    // draw grid
    out << "<g id=\"grid\" style=\""
           "fill: none; "
@@ -164,60 +156,25 @@ void Grid::draw_svg()
           "stroke-width: "   << grid_thickness << "; "
           "\">\n";
 
-   if (lowfirstcol == true) {
-      double x = 0.25*hw, 
-             y = 0.5*hh;
-
-      out << "<use x=\"" << x << "\" y=\"" << y
-          << "\" xlink:href=\"#outline\" />\n";
-
-      for (int r = 0; r < rows - 1; ++r) {
-         x = 0.75*hw;
-         out << "<use x=\"" << x << "\" y=\"" << y
-             << "\" xlink:href=\"#bottoms\" />\n";
-
-         x = 0.25*hw;
-         y += hh;
-
-         out << "<use x=\"" << x << "\" y=\"" << y
-             << "\" xlink:href=\"#tops\" />\n";
-      }
-
-      x = 0.75*hw;
-      out << "<use x=\"" << x << "\" y=\"" << y
-          << "\" xlink:href=\"#bottoms\" />\n";
+   if (svg_pattern) {
+      // the outline is drawn whole, over the edge of the pattern
+      out << "<use xlink:href=\"#outline\" />\n";
    }
    else {
-      double x = 0,
-             y = 0.5*hh;
-
-      out << "<use x=\"" << x << "\" y=\"" << y
-          << "\" xlink:href=\"#outline\" />\n";
-      
-      y = hh;
-
-      for (int r = 0; r < rows - 1; ++r) {
-         x = 0.75*hw;
-         out << "<use x=\"" << x << "\" y=\"" << y
-             << "\" xlink:href=\"#bottoms\" />\n";
-
-         x = 0.25*hw;
-
-         out << "<use x=\"" << x << "\" y=\"" << y
-             << "\" xlink:href=\"#tops\" />\n";
-
-         y += hh;
+      for (int r = 0; r < rows; ++r) {
+         out << "<use x=\"0\" y=\"" << r*hh
+             << "\" xlink:href=\"#row\" />\n";
       }
 
-      x = 0.75*hw;
-      out << "<use x=\"" << x << "\" y=\"" << y
-          << "\" xlink:href=\"#bottoms\" />\n";
+      out << "<path d=\"";
+      sides_svg(mesh, closing);
+      out << "\" />\n";
    }
 
    out << "</g>\n";
 
    // draw centers
-   if (center_style != Centerless) {
+   if (center_style != Centerless && !svg_pattern) {
       out << "<g id=\"centers\" ";
 
       switch (center_style) {
@@ -261,154 +218,196 @@ void Grid::draw_svg()
       double bcos = cos(coord_bearing*rad),
              bsin = sin(coord_bearing*rad);
 
-      for (int r = 0; r < rows; ++r) {
-         if ((r+coord_rstart) % coord_rskip) continue;
-         for (int c = 0; c < cols; ++c) {
-            if ((c+coord_cstart) % coord_cskip) continue;
-
-            int cc = 0, cr = 0;
-
-            switch (coord_origin) {
-            case UpperLeft:
-               cc = c+coord_cstart;
-               cr = r+coord_rstart;
-               break;
-            case UpperRight:
-               cc = cols-c-1+coord_cstart;
-               cr = r+coord_rstart;
-               break;
-            case LowerLeft:
-               cc = c+coord_cstart;
-               cr = rows-r-1+coord_rstart;
-               break;
-            case LowerRight:
-               cc = cols-c-1+coord_cstart;
-               cr = rows-r-1+coord_rstart;
-               break;
-            }
-
-            int a = cc, b = cr;
-            if (coord_order == RowsFirst) swap(a, b);
-
-            ostringstream s;
-            s << coord_fmt_pre;
-
-            switch (coord_first_style) {
-            case NoCoord:
-               break;
-            case Number:
-               if (coord_first_width) s << setw(coord_first_width);
-               if (coord_first_fill) s << setfill('0');
-               s << a;
-               break;
-            case Alpha:
-               s << alpha(a);
-               break;
-            case AlphaTally:
-               s << alpha_tally(a);
-               break;
+      // only every coord_rskip-th row and coord_cskip-th column
+      const int rs = skip_to(view_row+coord_rstart, coord_rskip),
+                cs = skip_to(view_col+coord_cstart, coord_cskip);
+
+      string s;
+      if (!svg_label_runs) {
+         for (int r = rs; r < rows; r += coord_rskip) {
+            for (int c = cs; c < cols; c += coord_cskip) {
+               labels.format(c+view_col, r+view_row, s);
+
+               double x = layout.x(c)+coord_dist*bcos;
+               double y = layout.y(c, r)+coord_dist*bsin;
+
+               out << "<text x=\"" << x
+                   << "\" y=\"" << y << "\"";
+               if (coord_tilt)
+                  out << " transform=\"rotate(" << coord_tilt
+                      << ' ' << x << ' ' << y << ")\"";
+               out << '>' << s << "</text>\n";
             }
-
-            s << coord_fmt_inter;
-
-            switch (coord_second_style) {
-            case NoCoord:
-               break;
-            case Number:
-               if (coord_second_width) s << setw(coord_second_width);
-               if (coord_second_fill) s << setfill('0');
-               s << b;
-               break;
-            case Alpha:
-               s << alpha(b);
-               break;
-            case AlphaTally:
-               s << alpha_tally(b);
-               break;
+         }
+      }
+      else {
+         //
+         // Each row of labels is one text, each label a tspan in it. The
+         // tilt turns the whole group, and each label is placed where
+         // the turn brings it back to its hex, so that it is turned about
+         // its own position as it would be alone. Untilted, the labels of
+         // every other column share a baseline, given once for the run.
+         //
+         const double tcos = cos(coord_tilt*rad),
+                      tsin = sin(coord_tilt*rad);
+
+         if (coord_tilt)
+            out << "<g transform=\"rotate(" << coord_tilt << ")\">\n";
+
+         for (int r = rs; r < rows; r += coord_rskip) {
+            for (int p = 0; p < (coord_tilt ? 1 : 2); ++p) {
+               bool begun = false;
+               for (int c = cs; c < cols; c += coord_cskip) {
+                  if (!coord_tilt && c % 2 != p) continue;
+                  labels.format(c+view_col, r+view_row, s);
+
+                  const double x = layout.x(c)+coord_dist*bcos,
+                               y = layout.y(c, r)+coord_dist*bsin;
+
+                  if (!begun) {
+                     out << "<text";
+                     if (!coord_tilt) out << " y=\"" << y << '"';
+                     out << '>';
+                     begun = true;
+                  }
+
+                  if (coord_tilt) {
+                     out << "<tspan x=\"" << x*tcos + y*tsin
+                         << "\" y=\"" << y*tcos - x*tsin << "\">";
+                  }
+                  else out << "<tspan x=\"" << x << "\">";
+                  out << s << "</tspan>";
+               }
+               if (begun) out << "</text>\n";
             }
-
-            double x = (c*0.75 + 0.5)*hw+coord_dist*bcos;
-            double y = (r + 0.5*(1 + (c+lowfirstcol)%2))*hh+coord_dist*bsin;
-
-            out << "<text x=\"" << x
-                << "\" y=\"" << y << "\"";
-            if (coord_tilt)
-               out << " transform=\"rotate(" << coord_tilt
-                   << ' ' << x << ' ' << y << ")\"";
-            out << '>' << s.str() << "</text>\n";
          }
+
+         if (coord_tilt) out << "</g>\n";
       }
       out << "</g>\n";
    }   
 
    out << "</g>\n";
-   out << "</svg>" << endl;
+   out << "</svg>\n";
+   out.close();
 
-   if (!outfile.empty()) out.close();
+   if (!out) throw runtime_error("error writing SVG");
 }
 
 
-void Grid::side_path_svg(int n)
+void Grid::pattern_svg()
 {
-   switch (n % 4) {
-   case 0:
-      out << ' ' << 0.25*hw << ' ' << 0.5*hh;
-      break;
-   case 2:
-      out << ' ' << 0.25*hw << ' ' << -0.5*hh;
-      break;
-   case 1:
-   case 3:
-      out << ' ' << 0.5*hw << " 0";
-      break;
+   //
+   // The grid repeats every two columns across and every row down, so
+   // one period of it, with the centers in it, makes a pattern tile. A
+   // pattern clips what it holds to its tile, so every hex reaching into
+   // the tile is drawn whole, and a side on the edge of the tile is
+   // drawn in the tiles on both sides of it. The tile starts at the
+   // corner of the box around the first hex.
+   //
+   const double pw = 1.5*hw, ph = hh,
+                px = layout.x(0) - 0.5*hw, py = layout.y(0, 0) - 0.5*hh;
+
+   // the centers of the two hexes of a period, within the tile
+   const double cx[] = { 0.5*hw, 1.25*hw },
+                cy[] = { 0.5*hh, layout.y(1, 0) - py };
+
+   // what lies within m of a center may reach into the tile
+   const double m = 0.5*hw + grid_thickness,
+                cm = center_size + 1;
+
+   // the clip path is the inside of the outline
+   out << "<clipPath id=\"inside\">"
+          "<use xlink:href=\"#outline\" />"
+          "</clipPath>\n";
+
+   out << "<pattern id=\"hexes\" patternUnits=\"userSpaceOnUse\" "
+          "x=\"" << px << "\" y=\"" << py << "\" "
+          "width=\"" << pw << "\" height=\"" << ph << "\">\n";
+
+   out << "<path style=\""
+          "fill: none; "
+          "stroke: #"        << grid_color << "; "
+          "stroke-opacity: " << grid_opacity << "; "
+          "stroke-width: "   << grid_thickness << "; "
+          "\" d=\"";
+
+   for (int k = 0; k < 2; ++k) {
+      for (int i = -1; i <= 1; ++i) {
+         for (int j = -1; j <= 1; ++j) {
+            const double x = cx[k] + i*pw, y = cy[k] + j*ph;
+            if (x+m < 0 || x-m > pw || y+m < 0 || y-m > ph) continue;
+
+            out << "M " << x - 0.5*hw << ' ' << y
+                << " l " << 0.25*hw << ' ' << -0.5*hh
+                << " h " << 0.5*hw
+                << " l " << 0.25*hw << ' ' << 0.5*hh
+                << " l " << -0.25*hw << ' ' << 0.5*hh
+                << " h " << -0.5*hw << " z ";
+         }
+      }
    }
-}
+   out << "\" />\n";
 
+   if (center_style != Centerless) {
+      switch (center_style) {
+      case Cross:
+         out << "<path style=\""
+                "stroke: #" << center_color << "; "
+                "stroke-opacity: " << center_opacity << "; "
+                "\" d=\"";
+         break;
+      case Dot:
+         out << "<g style=\""
+                "fill: #" << center_color << "; "
+                "fill-opacity: " << center_opacity << "; "
+                "\">\n";
+         break;
+      default:
+         break;
+      }
 
-void Grid::side_path_reverse_svg(int n)
-{
-   switch (n % 4) {
-   case 0:
-      out << ' ' << -0.25*hw << ' ' << 0.5*hh;
-      break;
-      break;
-   case 2:
-      out << ' ' << -0.25*hw << ' ' << -0.5*hh;
-      break;
-   case 1:
-   case 3:
-      out << ' ' << -0.5*hw << " 0";
-      break;
-   }
-}
-
+      for (int k = 0; k < 2; ++k) {
+         for (int i = -1; i <= 1; ++i) {
+            for (int j = -1; j <= 1; ++j) {
+               const double x = cx[k] + i*pw, y = cy[k] + j*ph;
+               if (x+cm < 0 || x-cm > pw || y+cm < 0 || y-cm > ph) continue;
+
+               if (center_style == Cross) {
+                  out << "M " << x - center_size << ' ' << y
+                      << " h " << 2*center_size
+                      << " M " << x << ' ' << y - center_size
+                      << " v " << 2*center_size << ' ';
+               }
+               else {
+                  out << "<circle cx=\"" << x << "\" cy=\"" << y
+                      << "\" r=\"" << center_size << "\" />\n";
+               }
+            }
+         }
+      }
 
-void Grid::side_skip_path_svg(int n)
-{
-   switch (n % 4) {
-   case 0:
-      out << " l " << 0.25*hw << ' ' << 0.5*hh;
-      break;
-   case 2:
-      out << " l " << 0.25*hw << ' ' << -0.5*hh;
-      break;
-   case 1:
-   case 3:
-      out << " m " << 0.5*hw << " 0";
-      break;
+      out << (center_style == Cross ? "\" />\n" : "</g>\n");
    }
-}
-
 
-void Grid::edge_path_svg(int n)
-{
-   out << ' ' << (n % 2 ? 0.25 : -0.25)*hw
-        << ' ' << 0.5*hh;
+   out << "</pattern>\n";
 }
 
 
-void Grid::edge_path_reverse_svg(int n)
+void Grid::sides_svg(const HexMesh &m, const vector<unsigned int> &sides)
 {
-   out << ' ' << (n % 2 ? 0.25 : -0.25)*hw
-        << ' ' << -0.5*hh;
+   vector<vector<unsigned int> > runs;
+   m.chain(sides, runs);
+
+   for (size_t i = 0; i < runs.size(); ++i) {
+      const vector<unsigned int> &run = runs[i];
+      const bool closed = run.size() > 3 && run.front() == run.back();
+      const size_t n = closed ? run.size() - 1 : run.size();
+
+      out << (i ? " M " : "M ")
+          << m.vx[run[0]] << ' ' << m.vy[run[0]] << " L";
+      for (size_t j = 1; j < n; ++j)
+         out << ' ' << m.vx[run[j]] << ' ' << m.vy[run[j]];
+      if (closed) out << " z";
+   }
 }
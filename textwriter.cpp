@@ -0,0 +1,225 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "textwriter.h"
+
+// the buffer goes to the stream when this much is in it
+static const size_t buffer_size = 1 << 16;
+
+// powers of ten, which are exact as doubles this far
+static const double tens[] = {
+   1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+   1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+static const unsigned long long int_tens[] = {
+   1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+   10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+   100000000000ull, 1000000000000ull, 10000000000000ull,
+   100000000000000ull, 1000000000000000ull
+};
+
+
+TextWriter::TextWriter()
+ : os(0), buf(buffer_size), n(0), precision(-1), failed(false)
+{
+}
+
+
+TextWriter::TextWriter(ostream &os, int precision)
+ : os(0), buf(buffer_size), n(0), precision(-1), failed(false)
+{
+   open(os, precision);
+}
+
+
+void TextWriter::open(ostream &os, int precision)
+{
+   this->os = &os;
+   this->precision = precision;
+   n = 0;
+   failed = false;
+}
+
+
+void TextWriter::close()
+{
+   flush();
+   os = 0;
+}
+
+
+void TextWriter::flush()
+{
+   drain();
+   if (os && !os->flush()) failed = true;
+}
+
+
+void TextWriter::drain()
+{
+   if (n && os && !os->write(&buf[0], n)) failed = true;
+   n = 0;
+}
+
+
+TextWriter &TextWriter::put(const char *s, size_t len)
+{
+   if (len > buf.size() - n) {
+      drain();
+
+      // what would not fit at all goes straight to the stream
+      if (len > buf.size()) {
+         if (os && !os->write(s, len)) failed = true;
+         return *this;
+      }
+   }
+
+   memcpy(&buf[n], s, len);
+   n += len;
+   return *this;
+}
+
+
+TextWriter &TextWriter::integer(bool negative, unsigned long long u)
+{
+   char t[24];
+   char *const end = t + sizeof(t);
+   char *p = end;
+
+   do *--p = '0' + u % 10; while (u /= 10);
+   if (negative) *--p = '-';
+   return put(p, end - p);
+}
+
+
+TextWriter &TextWriter::operator<<(double d)
+{
+   //
+   // The value is scaled by a power of ten and rounded to an integer, so
+   // that its decimal digits can be written as an integer's are. Scaling
+   // errs by less than w, so unless the scaled value lies within w of a
+   // boundary, which rounding might put on either side, it rounds as its
+   // exact decimal expansion would, and as the stream would round it.
+   //
+   if (!isfinite(d) || (d == 0 && precision < 0)) {
+      fallback(d);
+      return *this;
+   }
+
+   const double a = fabs(d);
+   int places;
+   double s;
+
+   if (precision < 0) {
+      // six significant digits, in fixed notation as the stream would
+      // use for values from 1e-4 up to 1e6, with the first digit 10^e
+      if (a < 1e-4 || a >= 1e6) {
+         fallback(d);
+         return *this;
+      }
+
+      int e = min(max(int(floor(log10(a))), -4), 5);
+      s = a * tens[5-e];
+      if (s >= 1e6 && e < 5) s = a * tens[5 - ++e];
+      else if (s < 1e5 && e > -4) s = a * tens[5 - --e];
+      places = 5-e;
+
+      if (s < 1e5 + 1e-9 || s > 1e6 - 1e-9) {
+         fallback(d);
+         return *this;
+      }
+   }
+   else {
+      places = precision;
+      s = a * tens[places];
+      if (s >= 1e15) {
+         fallback(d);
+         return *this;
+      }
+   }
+
+   const double w = s * 4.5e-16 + 1e-12;
+   const double f = s - floor(s);
+   if (fabs(f - 0.5) < w) {
+      fallback(d);
+      return *this;
+   }
+
+   unsigned long long u = (unsigned long long) floor(s) + (f > 0.5);
+
+   // rounding up may carry into a seventh significant digit
+   if (precision < 0 && u == 1000000) {
+      if (places == 0) {
+         fallback(d);
+         return *this;
+      }
+      u = 100000;
+      --places;
+   }
+
+   char t[48];
+   char *const end = t + sizeof(t);
+   char *p = end;
+
+   unsigned long long ip = u / int_tens[places],
+                      fp = u % int_tens[places];
+
+   // the fraction, without trailing zeros
+   int k = places;
+   while (k > 0 && fp % 10 == 0) {
+      fp /= 10;
+      --k;
+   }
+
+   if (k > 0) {
+      for (int j = 0; j < k; ++j, fp /= 10) *--p = '0' + fp % 10;
+      *--p = '.';
+   }
+
+   do *--p = '0' + ip % 10; while (ip /= 10);
+   if (d < 0 && u) *--p = '-';
+
+   return put(p, end - p);
+}
+
+
+void TextWriter::fallback(double d)
+{
+   ostringstream s;
+   if (precision >= 0) s << fixed << setprecision(precision);
+   s << d;
+
+   string r = s.str();
+   if (precision >= 0 && r.find('.') != string::npos) {
+      r.erase(r.find_last_not_of('0') + 1);
+      if (r[r.size()-1] == '.') r.erase(r.size()-1);
+   }
+   if (precision >= 0 && r == "-0") r = "0";
+   put(r.data(), r.size());
+}
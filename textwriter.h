@@ -0,0 +1,98 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __TEXTWRITER_H_
+#define __TEXTWRITER_H_
+
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+//
+// Writes the text of SVG and PostScript output. What is written collects
+// in a buffer, which is kept from one image to the next, and goes to the
+// stream only when the buffer fills or is flushed. Numbers are formatted
+// here rather than by the stream, the same way in any locale.
+//
+// Reals are written as ostream writes them by default, to six significant
+// digits, unless a precision is given, in which case they are written to
+// that many decimal places. Either way, trailing zeros are dropped.
+//
+class TextWriter {
+   public:
+      TextWriter();
+      TextWriter(ostream &os, int precision = -1);
+
+      // start writing to os; a negative precision is the stream's default
+      void open(ostream &os, int precision = -1);
+
+      // write out what is buffered, and stop writing to the stream; what
+      // is still buffered when a writer is destroyed is lost
+      void close();
+
+      // write out what is buffered
+      void flush();
+
+      // whether every write so far has succeeded
+      bool operator!() const { return failed; }
+
+      TextWriter &operator<<(char c) {
+         if (n == buf.size()) drain();
+         buf[n++] = c;
+         return *this;
+      }
+
+      TextWriter &operator<<(const char *s) { return put(s, strlen(s)); }
+      TextWriter &operator<<(const string &s) {
+         return put(s.data(), s.size());
+      }
+
+      TextWriter &operator<<(bool b) { return *this << (b ? '1' : '0'); }
+      TextWriter &operator<<(int i) { return integer(i < 0, magnitude(i)); }
+      TextWriter &operator<<(long i) { return integer(i < 0, magnitude(i)); }
+      TextWriter &operator<<(unsigned int u) { return integer(false, u); }
+      TextWriter &operator<<(unsigned long u) { return integer(false, u); }
+
+      TextWriter &operator<<(double d);
+
+   private:
+      TextWriter &put(const char *s, size_t len);
+      TextWriter &integer(bool negative, unsigned long long u);
+
+      template <typename T>
+      static unsigned long long magnitude(T i) {
+         return i < 0 ? 0ull - (unsigned long long) i : i;
+      }
+
+      // write what is buffered to the stream
+      void drain();
+
+      // write d as the stream would, for the values the fast path cannot
+      void fallback(double d);
+
+      ostream *os;
+      vector<char> buf;
+      size_t n;         // bytes of buf in use
+      int precision;    // decimal places, or negative for the default
+      bool failed;
+};
+
+#endif /* __TEXTWRITER_H_ */
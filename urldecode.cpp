@@ -0,0 +1,62 @@
+// $Id$
+/* mkhexgrid -- generates hex grids
+ * Copyright (C) 2006 Joel Uckelman
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cctype>
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+#include "urldecode.h"
+
+static int hex_digit(char c)
+{
+   if (c >= '0' && c <= '9') return c - '0';
+   c = tolower(c);
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   return -1;
+}
+
+
+string urldecode(const string &str)
+{
+   string out;
+   out.reserve(str.size());
+
+   for (string::size_type i = 0; i < str.size(); ++i) {
+      switch (str[i]) {
+      case '+':
+         out += ' ';
+         break;
+      case '%':
+      {
+         const int h = i+2 < str.size() ? hex_digit(str[i+1]) : -1,
+                   l = h >= 0 ? hex_digit(str[i+2]) : -1;
+         if (l < 0) throw runtime_error("malformed escape in `" + str + "'");
+         out += char(h*16 + l);
+         i += 2;
+         break;
+      }
+      default:
+         out += str[i];
+         break;
+      }
+   }
+
+   return out;
+}